@@ -0,0 +1,101 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <sys/prctl.h>
+
+#include "delay.hh"
+
+using namespace std::chrono_literals;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // Achieved delays reported as a histogram over the requested one:
+    // percentiles of the error, in percent of the requested delay, plus the
+    // CPU burnt per delay. Iteration time is the achieved delay.
+    template <typename F>
+    void achieved(benchmark::State& state, F delay) {
+        std::chrono::nanoseconds want = std::chrono::microseconds(state.range(0));
+        std::vector<double> err;
+        timespec cpu0, cpu1;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu0);
+        for (auto _ : state) {
+            auto start = Clock::now();
+            delay(want);
+            std::chrono::duration<double> took = Clock::now() - start;
+            state.SetIterationTime(took.count());
+            err.push_back(100 * (took - want) / want);
+        }
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu1);
+
+        std::sort(err.begin(), err.end());
+        auto pct = [&](double p) {
+            return err[std::min(err.size() - 1, size_t(p * err.size()))];
+        };
+        state.counters["err%_p1"] = pct(0.01);
+        state.counters["err%_p50"] = pct(0.5);
+        state.counters["err%_p90"] = pct(0.9);
+        state.counters["err%_p99"] = pct(0.99);
+        state.counters["err%_max"] = err.back();
+        auto cpu_ns = (cpu1.tv_sec - cpu0.tv_sec) * 1e9 +
+            (cpu1.tv_nsec - cpu0.tv_nsec);
+        state.counters["cpu_us"] = cpu_ns / 1e3 / err.size();
+    }
+
+    // Thread's timer slack for the duration of a benchmark
+    struct TimerSlack {
+        long before;
+
+        explicit TimerSlack(long ns) : before(prctl(PR_GET_TIMERSLACK)) {
+            prctl(PR_SET_TIMERSLACK, ns);
+        }
+
+        ~TimerSlack() {
+            prctl(PR_SET_TIMERSLACK, before);
+        }
+    };
+}
+
+// How delays were carried out before the delay engine
+static void BM_Delay_SleepFor(benchmark::State& state) {
+    achieved(state, [](auto d) { std::this_thread::sleep_for(d); });
+}
+BENCHMARK(BM_Delay_SleepFor)
+    ->UseManualTime()
+    ->Arg(5)->Arg(10)->Arg(20)->Arg(50)->Arg(200)->Arg(1000);
+
+static void BM_Delay_Engine(benchmark::State& state) {
+    sysfail::delay::calibrate();
+    achieved(state, [](auto d) { sysfail::delay::sleep(d, 100us); });
+}
+BENCHMARK(BM_Delay_Engine)
+    ->UseManualTime()
+    ->Arg(5)->Arg(10)->Arg(20)->Arg(50)->Arg(200)->Arg(1000);
+
+// Shorter spin, made up for by a small timer slack (refer Delays)
+static void BM_Delay_Engine_LowSlack(benchmark::State& state) {
+    sysfail::delay::calibrate();
+    TimerSlack slack(1000);
+    achieved(state, [](auto d) { sysfail::delay::sleep(d, 30us); });
+}
+BENCHMARK(BM_Delay_Engine_LowSlack)
+    ->UseManualTime()
+    ->Arg(5)->Arg(10)->Arg(20)->Arg(50)->Arg(200)->Arg(1000);
@@ -0,0 +1,126 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <sysfail.hh>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+using namespace std::chrono_literals;
+
+namespace {
+    // Plan that never fails write, so the benchmark measures the cost of
+    // getting a syscall to sysfail and back.
+    sysfail::Plan mk_plan(sysfail::syscall_dispatch::Mode dispatch) {
+        auto self = gettid();
+        return sysfail::Plan(
+            { {SYS_write, {0, 0, 0us, {}}} },
+            [self](pid_t tid) { return tid == self; },
+            sysfail::thread_discovery::None{},
+            dispatch);
+    }
+
+    void write_loop(benchmark::State& state) {
+        auto fd = open("/dev/null", O_WRONLY);
+        char c = 0;
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(write(fd, &c, 1));
+        }
+        close(fd);
+    }
+}
+
+static void BM_Write_NoSession(benchmark::State& state) {
+    write_loop(state);
+}
+BENCHMARK(BM_Write_NoSession);
+
+static void BM_Write_SUD(benchmark::State& state) {
+    sysfail::Session s(mk_plan(sysfail::syscall_dispatch::SUD{}));
+    write_loop(state);
+}
+BENCHMARK(BM_Write_SUD);
+
+static void BM_Write_Rewrite(benchmark::State& state) {
+    sysfail::Session s(mk_plan(sysfail::syscall_dispatch::Rewrite{}));
+    write_loop(state);
+}
+BENCHMARK(BM_Write_Rewrite);
+
+// libc blocks / restores signals around thread creation and teardown, each
+// such rt_sigprocmask is trapped to keep SIGSYS deliverable
+static void BM_SigprocmaskBlockAll(benchmark::State& state) {
+    sysfail::Session s(mk_plan(sysfail::syscall_dispatch::SUD{}));
+    sigset_t set, old;
+    sigfillset(&set);
+    for (auto _ : state) {
+        pthread_sigmask(SIG_BLOCK, &set, &old);
+        pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    }
+}
+BENCHMARK(BM_SigprocmaskBlockAll);
+
+namespace {
+    void spawn_loop(benchmark::State& state) {
+        for (auto _ : state) {
+            pthread_t t;
+            pthread_create(&t, nullptr, [](void*) -> void* { return nullptr; }, nullptr);
+            pthread_join(t, nullptr);
+        }
+    }
+}
+
+static void BM_ThreadSpawn_NoSession(benchmark::State& state) {
+    spawn_loop(state);
+}
+BENCHMARK(BM_ThreadSpawn_NoSession);
+
+// Thread spawn with the spawning thread enrolled (the new threads aren't)
+static void BM_ThreadSpawn_SUD(benchmark::State& state) {
+    sysfail::Session s(mk_plan(sysfail::syscall_dispatch::SUD{}));
+    spawn_loop(state);
+}
+BENCHMARK(BM_ThreadSpawn_SUD);
+
+namespace {
+    std::unique_ptr<sysfail::Session> shared_session;
+
+    void start_shared_session(const benchmark::State&) {
+        shared_session = std::make_unique<sysfail::Session>(sysfail::Plan(
+            { {SYS_write, {0, 0, 0us, {}}} },
+            [](pid_t) { return true; },
+            sysfail::thread_discovery::None{}));
+    }
+
+    void stop_shared_session(const benchmark::State&) {
+        shared_session.reset();
+    }
+}
+
+// Every trapped syscall looks up the session shared by all threads, this
+// should scale with the number of threads rather than contend on it
+static void BM_Write_SUD_Threads(benchmark::State& state) {
+    shared_session->add();
+    write_loop(state);
+    shared_session->remove();
+}
+BENCHMARK(BM_Write_SUD_Threads)
+    ->Setup(start_shared_session)
+    ->Teardown(stop_shared_session)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
@@ -0,0 +1,89 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <benchmark/benchmark.h>
+#include <sysfail.hh>
+#include <chrono>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "map.hh"
+
+using namespace std::chrono_literals;
+
+namespace {
+    // `n` extra mappings (on top of the process' own) for the duration of a
+    // benchmark, eg. to stand in for a JVM's
+    struct Mappings {
+        char* base = nullptr;
+        size_t len = 0;
+
+        explicit Mappings(size_t n) {
+            if (n == 0) return;
+            len = n * sysconf(_SC_PAGESIZE);
+            base = static_cast<char*>(mmap(
+                nullptr, len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+            // Alternating protections keep neighbours from merging
+            for (size_t i = 1; i < n; i += 2) {
+                mprotect(
+                    base + i * sysconf(_SC_PAGESIZE),
+                    sysconf(_SC_PAGESIZE),
+                    PROT_NONE);
+            }
+        }
+
+        ~Mappings() {
+            if (base) munmap(base, len);
+        }
+    };
+}
+
+static void BM_GetMmap(benchmark::State& state) {
+    Mappings m(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sysfail::get_mmap(getpid()));
+    }
+}
+BENCHMARK(BM_GetMmap)->ArgName("mappings")->Arg(0)->Arg(1000)->Arg(20000);
+
+static void BM_LibsysfailText(benchmark::State& state) {
+    Mappings m(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sysfail::libsysfail_text());
+    }
+}
+BENCHMARK(BM_LibsysfailText)->ArgName("mappings")->Arg(0)->Arg(20000);
+
+// Session start and end, without threads to enroll but the calling one
+template <typename Mode>
+static void BM_SessionStart(benchmark::State& state, Mode dispatch) {
+    Mappings m(state.range(0));
+    sysfail::Plan p(
+        { {SYS_getppid, {1.0, 0, 0us, {{EPERM, 1.0}}}} },
+        [](pid_t) { return true; },
+        sysfail::thread_discovery::None{},
+        dispatch);
+    for (auto _ : state) {
+        sysfail::Session s(p);
+    }
+}
+BENCHMARK_CAPTURE(BM_SessionStart, SUD, sysfail::syscall_dispatch::SUD{})
+    ->ArgName("mappings")->Arg(0)->Arg(20000);
+BENCHMARK_CAPTURE(
+    BM_SessionStart, Rewrite, sysfail::syscall_dispatch::Rewrite{}
+)->ArgName("mappings")->Arg(0)->Arg(20000);
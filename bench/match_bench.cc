@@ -0,0 +1,97 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <sysfail.hh>
+#include <cstring>
+#include <fcntl.h>
+
+#include "match.hh"
+
+using namespace sysfail;
+
+namespace {
+    // write(fd, buf, n) / openat(dirfd, path, flags) style registers,
+    // cycling through fds and flags so both outcomes are exercised
+    std::vector<std::array<greg_t, NGREG>> mk_regs() {
+        std::vector<std::array<greg_t, NGREG>> regs(64);
+        for (size_t i = 0; i < regs.size(); i++) {
+            regs[i].fill(0);
+            regs[i][REG_RDI] = 5 + (i % 7);
+            regs[i][REG_RSI] = (i % 3) ? O_DIRECT | O_RDWR : O_RDWR;
+            regs[i][REG_RDX] = i;
+        }
+        return regs;
+    }
+}
+
+// fd == 7 or fd in {9, 10}, via arity-typed invocation predicate
+static void BM_FdFilter_InvocationPredicate(benchmark::State& state) {
+    auto p = invp::p([](Syscall, invp::A fd, invp::A, invp::A) {
+        return fd == 7 || fd == 9 || fd == 10;
+    });
+    auto regs = mk_regs();
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(p(regs[i++ & 63].data()));
+    }
+}
+BENCHMARK(BM_FdFilter_InvocationPredicate);
+
+static void BM_FdFilter_TypedPredicate(benchmark::State& state) {
+    auto p = invp::on<SYS_write>([](int fd, const void*, size_t) {
+        return fd == 7 || fd == 9 || fd == 10;
+    });
+    auto regs = mk_regs();
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(p(regs[i++ & 63].data()));
+    }
+}
+BENCHMARK(BM_FdFilter_TypedPredicate);
+
+static void BM_FdFilter_RuleProgram(benchmark::State& state) {
+    match::Program p(match::arg(1) == 7 || match::arg(1).in({9, 10}));
+    auto regs = mk_regs();
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(p(regs[i++ & 63].data()));
+    }
+}
+BENCHMARK(BM_FdFilter_RuleProgram);
+
+// flags & O_DIRECT
+static void BM_FlagFilter_InvocationPredicate(benchmark::State& state) {
+    auto p = invp::p([](Syscall, invp::A, invp::A flags) {
+        return (flags & O_DIRECT) != 0;
+    });
+    auto regs = mk_regs();
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(p(regs[i++ & 63].data()));
+    }
+}
+BENCHMARK(BM_FlagFilter_InvocationPredicate);
+
+static void BM_FlagFilter_RuleProgram(benchmark::State& state) {
+    match::Program p(match::arg(2).any_of(O_DIRECT));
+    auto regs = mk_regs();
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(p(regs[i++ & 63].data()));
+    }
+}
+BENCHMARK(BM_FlagFilter_RuleProgram);
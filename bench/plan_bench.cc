@@ -0,0 +1,317 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <sysfail.hh>
+#include <sysfail_static.hh>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <unistd.h>
+#include <cstring>
+
+#include "session.hh"
+
+using namespace std::chrono_literals;
+
+namespace {
+    // Plan with `n` syscalls spread across the syscall number space, none of
+    // which are in the hot-set below.
+    sysfail::Plan mk_plan(int n) {
+        std::unordered_map<sysfail::Syscall, const sysfail::Outcome> o;
+        for (int i = 0, call = 400; i < n; i++, call = (call + 37) % 450) {
+            while (o.contains(call) || call == SYS_getppid) call++;
+            o.insert({call, {0, 0, 0us, {}}});
+        }
+        auto self = gettid();
+        return sysfail::Plan(
+            o,
+            [self](pid_t tid) { return tid == self; },
+            sysfail::thread_discovery::None{});
+    }
+
+    // Syscalls a typical server thread makes, mostly unplanned
+    std::vector<sysfail::Syscall> syscall_mix() {
+        std::vector<sysfail::Syscall> hot{
+            SYS_futex, SYS_read, SYS_write, SYS_epoll_wait, SYS_clock_gettime,
+            SYS_recvfrom, SYS_sendto, SYS_mmap, SYS_munmap, SYS_openat,
+            SYS_close, SYS_fstat, SYS_lseek, SYS_pread64, SYS_pwrite64};
+        std::mt19937 rnd(42);
+        std::uniform_int_distribution<int> any(0, 449);
+        std::uniform_int_distribution<size_t> pick(0, hot.size() - 1);
+        std::vector<sysfail::Syscall> mix;
+        for (int i = 0; i < 4096; i++) {
+            mix.push_back(i % 8 == 0 ? any(rnd) : hot[pick(rnd)]);
+        }
+        return mix;
+    }
+}
+
+// Lookup as it was done before ActivePlan had the dense table
+static void BM_OutcomeLookup_HashMap(benchmark::State& state) {
+    auto plan = mk_plan(state.range(0));
+    std::unordered_map<sysfail::Syscall, const sysfail::ActiveOutcome> outcomes;
+    for (const auto& [call, o] : plan.outcomes) outcomes.insert({call, o});
+    auto mix = syscall_mix();
+
+    size_t i = 0;
+    for (auto _ : state) {
+        auto o = outcomes.find(mix[i++ & 4095]);
+        benchmark::DoNotOptimize(o == outcomes.end());
+    }
+}
+BENCHMARK(BM_OutcomeLookup_HashMap)->Arg(1)->Arg(10)->Arg(100);
+
+static void BM_OutcomeLookup_Table(benchmark::State& state) {
+    sysfail::ActivePlan plan(mk_plan(state.range(0)));
+    auto mix = syscall_mix();
+
+    size_t i = 0;
+    for (auto _ : state) {
+        auto o = plan.outcome(mix[i++ & 4095]);
+        benchmark::DoNotOptimize(o);
+    }
+}
+BENCHMARK(BM_OutcomeLookup_Table)->Arg(1)->Arg(10)->Arg(100);
+
+// End-to-end cost of an unplanned syscall made by an enrolled thread
+static void BM_UnplannedSyscall(benchmark::State& state) {
+    sysfail::Session s(mk_plan(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(syscall(SYS_getppid));
+    }
+}
+BENCHMARK(BM_UnplannedSyscall)->Arg(1)->Arg(10)->Arg(100);
+
+static void BM_UnplannedSyscall_NoSession(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(syscall(SYS_getppid));
+    }
+}
+BENCHMARK(BM_UnplannedSyscall_NoSession);
+
+// Session start / stop, compiling the plan every time vs sharing a compiled
+// plan across sessions
+static void BM_SessionCycle_Plan(benchmark::State& state) {
+    auto plan = mk_plan(state.range(0));
+    for (auto _ : state) {
+        sysfail::Session s(plan);
+    }
+}
+BENCHMARK(BM_SessionCycle_Plan)->Arg(1)->Arg(100)->Arg(400);
+
+static void BM_SessionCycle_CompiledPlan(benchmark::State& state) {
+    auto plan = mk_plan(state.range(0)).compile();
+    for (auto _ : state) {
+        sysfail::Session s(plan);
+    }
+}
+BENCHMARK(BM_SessionCycle_CompiledPlan)->Arg(1)->Arg(100)->Arg(400);
+
+namespace {
+    using namespace sysfail::static_plan;
+
+    // The same plan, static and dynamic: a storage-engine-like mix with a
+    // predicate on pwrite64
+    using StaticIoPlan = sysfail::StaticPlan<
+        Rule<SYS_read, Fail<0.01>, Error<EIO>>,
+        Rule<SYS_write, Fail<0.01>, Error<EIO>, Error<ENOSPC, 3>>,
+        Rule<SYS_pread64, Fail<0.01>, Delay<0.05, 100>, Error<EIO>>,
+        Rule<SYS_pwrite64,
+            Fail<0.02, 0.5>,
+            Error<EIO>,
+            Error<ENOSPC, 2>,
+            Where<[](const greg_t* r) { return r[REG_RDI] == 7; }>>,
+        Rule<SYS_fsync, Fail<0.05>, Error<EIO>>,
+        Rule<SYS_fdatasync, Fail<0.05>, Error<EIO>>,
+        Rule<SYS_openat, Fail<0.01>, Error<EMFILE>, Error<EACCES>>,
+        Rule<SYS_close, Delay<0.01, 50>>>;
+
+    sysfail::Plan dynamic_io_plan() {
+        using std::chrono::microseconds;
+        return sysfail::Plan(
+            { {SYS_read, {0.01, 0, 0us, {{EIO, 1}}}},
+              {SYS_write, {0.01, 0, 0us, {{EIO, 1}, {ENOSPC, 3}}}},
+              {SYS_pread64, {0.01, 0.05, 100us, {{EIO, 1}}}},
+              {SYS_pwrite64, {
+                  {0.02, 0.5},
+                  0,
+                  0us,
+                  {{EIO, 1}, {ENOSPC, 2}},
+                  sysfail::invp::p([](sysfail::Syscall, sysfail::invp::A fd,
+                      sysfail::invp::A, sysfail::invp::A, sysfail::invp::A) {
+                      return fd == 7;
+                  })}},
+              {SYS_fsync, {0.05, 0, 0us, {{EIO, 1}}}},
+              {SYS_fdatasync, {0.05, 0, 0us, {{EIO, 1}}}},
+              {SYS_openat, {0.01, 0, 0us, {{EMFILE, 1}, {EACCES, 1}}}},
+              {SYS_close, {0, 0.01, 50us, {}}} },
+            [](pid_t) { return true; },
+            sysfail::thread_discovery::None{});
+    }
+
+    // Trapped syscalls: planned ones, and some unplanned ones (as seen with
+    // Rewrite dispatch, where every syscall takes the slow path)
+    std::vector<std::array<greg_t, NGREG>> io_mix() {
+        std::vector<sysfail::Syscall> calls{
+            SYS_read, SYS_write, SYS_pread64, SYS_pwrite64, SYS_fsync,
+            SYS_fdatasync, SYS_openat, SYS_close, SYS_futex, SYS_getppid};
+        std::mt19937 rnd(42);
+        std::uniform_int_distribution<size_t> pick(0, calls.size() - 1);
+        std::vector<std::array<greg_t, NGREG>> mix(4096);
+        for (auto& r : mix) {
+            r.fill(0);
+            r[REG_RAX] = calls[pick(rnd)];
+            r[REG_RDI] = 7;
+        }
+        return mix;
+    }
+}
+
+static void BM_Decide_Plan(benchmark::State& state) {
+    sysfail::ActivePlan plan(dynamic_io_plan());
+    auto mix = io_mix();
+    sysfail::Rng rng(42);
+
+    size_t i = 0;
+    for (auto _ : state) {
+        sysfail::Injection inj;
+        plan.decide(mix[i++ & 4095].data(), rng, inj);
+        benchmark::DoNotOptimize(inj);
+    }
+}
+BENCHMARK(BM_Decide_Plan);
+
+static void BM_Decide_StaticPlan(benchmark::State& state) {
+    auto c = StaticIoPlan::compile(
+        [](pid_t) { return true; },
+        sysfail::thread_discovery::None{});
+    const sysfail::ActivePlan& plan = *c;
+    auto mix = io_mix();
+    sysfail::Rng rng(42);
+
+    size_t i = 0;
+    for (auto _ : state) {
+        sysfail::Injection inj;
+        plan.decide(mix[i++ & 4095].data(), rng, inj);
+        benchmark::DoNotOptimize(inj);
+    }
+}
+BENCHMARK(BM_Decide_StaticPlan);
+
+namespace {
+    std::map<sysfail::Errno, double> error_mix(int n) {
+        std::map<sysfail::Errno, double> w;
+        for (int i = 0; i < n; i++) w[i + 1] = i + 1;
+        return w;
+    }
+}
+
+// Error selection as it was done before the alias table
+static void BM_ErrorPick_CumulativeMap(benchmark::State& state) {
+    std::map<double, sysfail::Errno> by_cumulative_p;
+    double total = 0;
+    for (const auto& [e, w] : error_mix(state.range(0))) total += w;
+    double cumulative = 0;
+    for (const auto& [e, w] : error_mix(state.range(0))) {
+        cumulative += w / total;
+        by_cumulative_p[cumulative] = e;
+    }
+    std::mt19937 rnd(42);
+    std::uniform_real_distribution<double> p_dist(0, 1);
+
+    for (auto _ : state) {
+        auto e = by_cumulative_p.lower_bound(p_dist(rnd));
+        benchmark::DoNotOptimize(e);
+    }
+}
+BENCHMARK(BM_ErrorPick_CumulativeMap)->Arg(1)->Arg(4)->Arg(12);
+
+static void BM_ErrorPick_AliasTable(benchmark::State& state) {
+    sysfail::ErrorTable t(error_mix(state.range(0)));
+    sysfail::Rng rnd(42);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(t.pick(rnd.next()));
+    }
+}
+BENCHMARK(BM_ErrorPick_AliasTable)->Arg(1)->Arg(4)->Arg(12);
+
+// Injection decision (fail? after? which error?) as done before thresholds
+static void BM_FailDecision_Mt19937(benchmark::State& state) {
+    std::mt19937 rnd(42);
+    std::uniform_real_distribution<double> p_dist(0, 1);
+    double fail = 0.3, after = 0.5, err = 0.7;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(p_dist(rnd) < fail);
+        benchmark::DoNotOptimize(p_dist(rnd) < err);
+        benchmark::DoNotOptimize(p_dist(rnd) < after);
+    }
+}
+BENCHMARK(BM_FailDecision_Mt19937);
+
+static void BM_FailDecision_Xoshiro(benchmark::State& state) {
+    sysfail::Rng rnd(42);
+    auto fail = sysfail::threshold(0.3);
+    auto after = sysfail::threshold(0.5);
+    auto err = sysfail::threshold(0.7);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(rnd.chance(fail));
+        benchmark::DoNotOptimize(rnd.chance(err));
+        benchmark::DoNotOptimize(rnd.chance(after));
+    }
+}
+BENCHMARK(BM_FailDecision_Xoshiro);
+
+namespace {
+    const std::vector<sysfail::latency::Distribution> latencies{
+        sysfail::latency::UpToMax{},
+        sysfail::latency::Constant{50us},
+        sysfail::latency::Uniform{10us, 100us},
+        sysfail::latency::Exponential{50us},
+        sysfail::latency::Normal{50us, 10us},
+        sysfail::latency::LogNormal{50us, 0.5},
+        sysfail::latency::Pareto{10us, 1.5},
+        sysfail::latency::Bimodal{
+            0.01,
+            sysfail::latency::LogNormal{50us, 0.3},
+            sysfail::latency::Pareto{1000us, 1.5}}};
+}
+
+// Drawing a delay, by distribution (in the order of `latencies`). Achieved
+// percentiles (in microseconds) are reported alongside.
+static void BM_LatencySample(benchmark::State& state) {
+    sysfail::LatencySampler l(latencies[state.range(0)], 10ms);
+    sysfail::Rng rnd(42);
+    std::vector<double> us;
+
+    for (auto _ : state) {
+        auto d = l.sample(rnd);
+        benchmark::DoNotOptimize(d);
+        if (us.size() < 1 << 20) us.push_back(d.count() / 1e3);
+    }
+
+    std::sort(us.begin(), us.end());
+    auto pct = [&](double p) { return us[p * (us.size() - 1)]; };
+    state.counters["p50_us"] = pct(0.5);
+    state.counters["p90_us"] = pct(0.9);
+    state.counters["p99_us"] = pct(0.99);
+    state.counters["p999_us"] = pct(0.999);
+}
+BENCHMARK(BM_LatencySample)->DenseRange(0, 7);
@@ -0,0 +1,173 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <sysfail.hh>
+#include <chrono>
+#include <latch>
+#include <semaphore>
+#include <thread>
+#include <vector>
+#include <optional>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+using namespace std::chrono_literals;
+
+namespace {
+    // Threads parked for the duration of a benchmark, enrolled and removed
+    // by the benchmark loop
+    struct Parked {
+        std::vector<std::thread> threads;
+        std::vector<pid_t> tids;
+        std::latch started;
+        std::counting_semaphore<> release{0};
+
+        explicit Parked(size_t n) : tids(n), started(n) {
+            for (size_t i = 0; i < n; i++) {
+                threads.emplace_back([this, i] {
+                    tids[i] = gettid();
+                    started.count_down();
+                    release.acquire();
+                });
+            }
+            started.wait();
+        }
+
+        ~Parked() {
+            release.release(threads.size());
+            for (auto& t : threads) t.join();
+        }
+    };
+
+    sysfail::Plan mk_plan() {
+        return sysfail::Plan(
+            { {SYS_write, {0, 0, 0us, {}}} },
+            [](pid_t) { return true; },
+            sysfail::thread_discovery::None{});
+    }
+}
+
+static void BM_AddRemoveThreads_OneByOne(benchmark::State& state) {
+    Parked p(state.range(0));
+    sysfail::Session s(mk_plan());
+    for (auto _ : state) {
+        for (auto tid : p.tids) s.add(tid);
+        for (auto tid : p.tids) s.remove(tid);
+    }
+}
+BENCHMARK(BM_AddRemoveThreads_OneByOne)->RangeMultiplier(8)->Range(8, 512);
+
+static void BM_AddRemoveThreads_Batched(benchmark::State& state) {
+    Parked p(state.range(0));
+    sysfail::Session s(mk_plan());
+    for (auto _ : state) {
+        s.add(p.tids);
+        s.remove(p.tids);
+    }
+}
+BENCHMARK(BM_AddRemoveThreads_Batched)->RangeMultiplier(8)->Range(8, 512);
+
+static void BM_PauseResume(benchmark::State& state) {
+    Parked p(state.range(0));
+    sysfail::Session s(mk_plan());
+    s.add(p.tids);
+    for (auto _ : state) {
+        s.pause();
+        s.resume();
+    }
+    s.remove(p.tids);
+}
+BENCHMARK(BM_PauseResume)->RangeMultiplier(8)->Range(8, 512);
+
+// Confining injection to a region with add / remove vs a Scope
+static void BM_AddRemoveSelf(benchmark::State& state) {
+    sysfail::Session s(mk_plan());
+    s.remove();
+    for (auto _ : state) {
+        s.add();
+        s.remove();
+    }
+}
+BENCHMARK(BM_AddRemoveSelf);
+
+static void BM_ScopeEnterExit(benchmark::State& state) {
+    sysfail::Session s(mk_plan());
+    s.suspend();
+    for (auto _ : state) {
+        sysfail::Scope sc;
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_ScopeEnterExit);
+
+// Time from spawning a thread until its syscalls are failure-injected
+template <typename Disc>
+static void BM_SpawnToEnrolled(benchmark::State& state, Disc disc) {
+    using clock = std::chrono::steady_clock;
+    sysfail::Session s(sysfail::Plan(
+        { {SYS_getppid, {1.0, 0, 0us, {{EPERM, 1.0}}}} },
+        [](pid_t) { return true; },
+        disc));
+    for (auto _ : state) {
+        auto start = clock::now();
+        clock::time_point enrolled;
+        std::thread([&] {
+            while (syscall(SYS_getppid) >= 0);
+            enrolled = clock::now();
+        }).join();
+        state.SetIterationTime(
+            std::chrono::duration<double>(enrolled - start).count());
+    }
+}
+BENCHMARK_CAPTURE(
+    BM_SpawnToEnrolled, ProcPoll_10ms, sysfail::thread_discovery::ProcPoll{}
+)->UseManualTime();
+BENCHMARK_CAPTURE(
+    BM_SpawnToEnrolled, ProcPoll_1ms, sysfail::thread_discovery::ProcPoll{1ms}
+)->UseManualTime();
+BENCHMARK_CAPTURE(
+    BM_SpawnToEnrolled, OnClone, sysfail::thread_discovery::OnClone{}
+)->UseManualTime();
+BENCHMARK_CAPTURE(
+    BM_SpawnToEnrolled,
+    ProcConnector,
+    sysfail::thread_discovery::ProcConnector{}
+)->UseManualTime();
+
+// Forking a worker and reaping it, the child is ready (re-armed, with thread
+// discovery restarted) once fork returns. With a session the parent has
+// `threads` more enrolled threads, none of which make it to the child.
+static void BM_ForkWorker(benchmark::State& state) {
+    Parked p(state.range(0));
+    std::optional<sysfail::Session> s;
+    if (state.range(1)) {
+        s.emplace(sysfail::Plan(
+            { {SYS_write, {0, 0, 0us, {}}} },
+            [](pid_t) { return true; },
+            sysfail::thread_discovery::ProcPoll{}));
+    }
+    for (auto _ : state) {
+        auto pid = fork();
+        if (pid == 0) _exit(0);
+        int status;
+        waitpid(pid, &status, 0);
+    }
+}
+BENCHMARK(BM_ForkWorker)
+    ->ArgNames({"threads", "session"})
+    ->ArgsProduct({{0, 64}, {0, 1}});
@@ -0,0 +1,95 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <semaphore>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <pthread.h>
+
+#include "thdmon.hh"
+#include "helpers.hh"
+
+namespace {
+    // Idle threads for the scanner to find, on small stacks so that 10k of
+    // them fit comfortably
+    struct Idle {
+        std::vector<pthread_t> threads;
+        std::counting_semaphore<> release{0};
+
+        explicit Idle(size_t n) : threads(n) {
+            pthread_attr_t attr;
+            pthread_attr_init(&attr);
+            pthread_attr_setstacksize(&attr, 64 * 1024);
+            for (auto& t : threads) {
+                pthread_create(&t, &attr, [](void* self) -> void* {
+                    static_cast<Idle*>(self)->release.acquire();
+                    return nullptr;
+                }, this);
+            }
+            pthread_attr_destroy(&attr);
+        }
+
+        ~Idle() {
+            release.release(threads.size());
+            for (auto t : threads) pthread_join(t, nullptr);
+        }
+    };
+}
+
+static void BM_ScanTasks(benchmark::State& state) {
+    Idle idle(state.range(0));
+    sysfail::ThdMon tmon(
+        sysfail::thread_discovery::None{},
+        [](std::span<const pid_t>, sysfail::DiscThdSt) {});
+    for (auto _ : state) {
+        tmon.rescan_threads();
+    }
+}
+BENCHMARK(BM_ScanTasks)->Arg(100)->Arg(1000)->Arg(10000);
+
+// What scans used to do: directory_iterator, a string and stoi per entry and
+// two passes over a map
+static void BM_ScanTasks_Filesystem(benchmark::State& state) {
+    namespace fs = std::filesystem;
+    Idle idle(state.range(0));
+    std::unordered_map<pid_t, uint32_t> known;
+    uint32_t gen = 0;
+    for (auto _ : state) {
+        gen++;
+        std::vector<pid_t> found;
+        for (const auto& entry : fs::directory_iterator(sysfail::tasks_dir)) {
+            pid_t tid = std::stoi(entry.path().filename().string());
+            auto it = known.find(tid);
+            if (it == known.end()) {
+                found.push_back(tid);
+            } else {
+                it->second = gen;
+            }
+        }
+        for (auto tid : found) known.insert({tid, gen});
+        std::vector<pid_t> gone;
+        for (auto [tid, g] : known) {
+            if (g < gen) gone.push_back(tid);
+        }
+        for (auto tid : gone) known.erase(tid);
+        benchmark::DoNotOptimize(found.data());
+    }
+}
+BENCHMARK(BM_ScanTasks_Filesystem)->Arg(100)->Arg(1000)->Arg(10000);
@@ -23,6 +23,9 @@
 
 typedef pid_t sysfail_tid_t;
 
+// Token for an open scope (refer `enter_scope` in sysfail_session_t)
+typedef void* sysfail_scope_t;
+
 /**
  * Probability values are in the range [0, 1].
  * 0 means never fail or delay, 1 means always fail or delay.
@@ -72,6 +75,44 @@ greg_t sysfail_syscall_arg(const greg_t*, int);
  */
 typedef int(*sysfail_invocation_predicate_t)(sysfail_userdata_t*, const greg_t*);
 
+/**
+ * Shapes of injected delay latency (refer `sysfail::latency`). Parameters are
+ * in microseconds unless noted.
+ */
+enum {
+    // Uniform in [0, max_delay_usec], no parameters
+    sysfail_latency_up_to_max  = 0,
+    // p1
+    sysfail_latency_constant   = 1,
+    // Uniform in [p1, p2]
+    sysfail_latency_uniform    = 2,
+    // Mean p1
+    sysfail_latency_exponential = 3,
+    // Mean p1, standard deviation p2
+    sysfail_latency_normal     = 4,
+    // Median p1, sigma (of the underlying normal, unitless) p2
+    sysfail_latency_lognormal  = 5,
+    // Scale (minimum) p1, shape (unitless) p2
+    sysfail_latency_pareto     = 6,
+} typedef sysfail_latency_kind_t;
+
+struct {
+    sysfail_latency_kind_t kind;
+    double p1;
+    double p2;
+} typedef sysfail_latency_dist_t;
+
+/**
+ * Latency of injected delays, `mode` unless `p_alt` > 0, in which case it is
+ * a bimodal mixture that draws from `alt` with probability `p_alt`.
+ * Zero-initialized, it is uniform up to max delay.
+ */
+struct {
+    sysfail_latency_dist_t mode;
+    double p_alt;
+    sysfail_latency_dist_t alt;
+} typedef sysfail_latency_t;
+
 /**
  * `sysfail_outcome_t` is the outcome of a syscall.
  */
@@ -92,6 +133,9 @@ struct {
     uint32_t num_errors;
     // Actual error codes and their weights
     sysfail_error_wt_t *error_wts;
+
+    // Latency distribution of delays, capped at max_delay_usec (unless 0)
+    sysfail_latency_t latency;
 } typedef sysfail_outcome_t;
 
 /**
@@ -113,13 +157,34 @@ enum {
     // Poll to discover threads at regular intervals, manual controls can also
     // be used in conjunction with automatic discovery.
     sysfail_tdisk_poll  = 1,
+    // Threads spawned by enrolled threads enroll themselves as they start,
+    // refer `sysfail::thread_discovery::OnClone`.
+    sysfail_tdisc_on_clone = 2,
+    // Threads are discovered as the kernel reports them spawned (netlink proc
+    // connector), falling back to polling every `poll_itvl_usec` where it is
+    // unavailable. Refer `sysfail::thread_discovery::ProcConnector`.
+    sysfail_tdisc_proc_connector = 3,
 } typedef sysfail_thread_discovery_strategy_t;
 
+/**
+ * `sysfail_dispatch_t` is the mechanism used to intercept syscalls.
+ */
+enum {
+    // Syscall-user-dispatch, every syscall of enrolled threads is trapped
+    sysfail_dispatch_sud     = 0,
+    // Seccomp-BPF filter, only planned syscalls are trapped. Filters can't be
+    // removed, refer `sysfail::syscall_dispatch::Seccomp` for caveats.
+    sysfail_dispatch_seccomp = 1,
+    // Syscall-user-dispatch, trapping syscall sites are rewritten to call into
+    // sysfail directly. Refer `sysfail::syscall_dispatch::Rewrite` for caveats.
+    sysfail_dispatch_rewrite = 2,
+} typedef sysfail_dispatch_t;
+
 /**
  * `sysfail_thread_discovery_t` is the configuration for thread discovery.
  */
 union {
-    // Polling interval in microseconds
+    // Polling interval in microseconds (fallback interval for proc connector)
     uint32_t poll_itvl_usec;
 } typedef sysfail_thread_discovery_t;
 
@@ -154,6 +219,9 @@ struct {
 
     // Outcomes for syscalls (list)
     sysfail_syscall_outcome_t* syscall_outcomes;
+
+    // Mechanism for intercepting syscalls
+    sysfail_dispatch_t dispatch;
 } typedef sysfail_plan_t;
 
 /**
@@ -182,6 +250,34 @@ struct sysfail_session_s {
 
     // Discover threads using the strategy configured in the plan
     void (*discover_threads)(sysfail_session_t*);
+
+    // Enable failure injection on the threads in the given array of tids,
+    // signalling all of them before waiting on any
+    void (*add_threads)(sysfail_session_t*, const sysfail_tid_t*, size_t);
+
+    // Disable failure injection on the threads in the given array of tids
+    void (*remove_threads)(sysfail_session_t*, const sysfail_tid_t*, size_t);
+
+    // Stop / resume failure injection on all enrolled threads without removing
+    // them. Only flips per-thread state, no syscalls or signals (refer
+    // Session::pause in sysfail.hh for caveats).
+    void (*pause)(sysfail_session_t*);
+    void (*resume)(sysfail_session_t*);
+
+    // Stop / resume failure injection on one enrolled thread, same as above
+    void (*suspend_thread)(sysfail_session_t*, sysfail_tid_t);
+    void (*unsuspend_thread)(sysfail_session_t*, sysfail_tid_t);
+
+    // Stop / resume failure injection on the current (calling) thread
+    void (*suspend_this_thread)(sysfail_session_t*);
+    void (*unsuspend_this_thread)(sysfail_session_t*);
+
+    // Inject failures into the current (calling) thread, even if suspended,
+    // until the matching exit_scope (refer sysfail::Scope in sysfail.hh). Makes
+    // no syscalls, scopes nest. Every enter_scope must be paired with an
+    // exit_scope on the same thread, passing the token it returned.
+    sysfail_scope_t (*enter_scope)(sysfail_session_t*);
+    void (*exit_scope)(sysfail_session_t*, sysfail_scope_t);
 };
 
 /**
@@ -196,4 +292,29 @@ struct sysfail_session_s {
  */
 sysfail_session_t* sysfail_start(const sysfail_plan_t*);
 
+/**
+ * `sysfail_compiled_plan_t` is a plan compiled ahead of sessions, refer
+ * `sysfail::Plan::compile`. Sessions started from it do no work for the plan
+ * and any number of them (one after another, from any thread) can share it.
+ */
+typedef struct sysfail_compiled_plan_s sysfail_compiled_plan_t;
+
+/**
+ * Compile the plan. The compiled plan has copies of everything it needs, the
+ * plan can be freed right away (user data and callbacks must outlive it).
+ * Caller must free the compiled plan using `sysfail_compiled_plan_free`.
+ */
+sysfail_compiled_plan_t* sysfail_plan_compile(const sysfail_plan_t*);
+
+/**
+ * Free the compiled plan. Sessions started from it keep their own reference,
+ * so it can be freed while they are running.
+ */
+void sysfail_compiled_plan_free(sysfail_compiled_plan_t*);
+
+/**
+ * Same as `sysfail_start`, for a compiled plan.
+ */
+sysfail_session_t* sysfail_start_compiled(const sysfail_compiled_plan_t*);
+
 #endif
\ No newline at end of file
@@ -20,6 +20,8 @@
 #include <chrono>
 #include <memory>
 #include <map>
+#include <vector>
+#include <span>
 #include <functional>
 #include <shared_mutex>
 #include <sys/syscall.h>
@@ -27,6 +29,12 @@
 #include <variant>
 #include <signal.h>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <tuple>
+#include <cstdint>
+
+#include "sysfail_syscalls.hh"
 
 namespace sysfail {
     // Syscall number
@@ -88,6 +96,196 @@ namespace sysfail {
 
         // Generates a general invocation predicate given arity-aware definition
         InvocationPredicate p(P p);
+
+        namespace detail {
+            template <typename F> struct Params
+                : Params<decltype(&F::operator())> {};
+            template <typename C, typename R, typename... As>
+            struct Params<R (C::*)(As...) const> {
+                using T = std::tuple<As...>;
+            };
+            template <typename C, typename R, typename... As>
+            struct Params<R (C::*)(As...)> {
+                using T = std::tuple<As...>;
+            };
+            template <typename R, typename... As>
+            struct Params<R (*)(As...)> {
+                using T = std::tuple<As...>;
+            };
+
+            // Argument registers in syscall ABI order
+            constexpr int regs[] = {
+                REG_RDI, REG_RSI, REG_RDX, REG_R10, REG_R8, REG_R9
+            };
+
+            template <typename T>
+            constexpr bool binds(syscalls::ArgKind k) {
+                using U = std::remove_cvref_t<T>;
+                constexpr auto ptr = std::is_pointer_v<U>;
+                constexpr auto num = std::is_integral_v<U> || std::is_enum_v<U>;
+                // Some addresses are declared as unsigned long (eg. mmap), so
+                // integer arguments can be taken as pointers too.
+                return k == syscalls::ArgKind::Ptr ? ptr : (ptr || num);
+            }
+
+            template <typename T>
+            T cast(A a) {
+                using U = std::remove_cvref_t<T>;
+                if constexpr (std::is_pointer_v<U>) {
+                    return reinterpret_cast<U>(static_cast<uintptr_t>(a));
+                } else {
+                    return static_cast<U>(a);
+                }
+            }
+
+            template <Syscall N, typename F, typename Ps, size_t... Is>
+            InvocationPredicate on(F f, std::index_sequence<Is...>) {
+                constexpr auto i = syscalls::info(N);
+                static_assert(
+                    (binds<std::tuple_element_t<Is, Ps>>(i->arg(Is)) && ...),
+                    "Predicate parameter type doesn't match syscall argument "
+                    "(pointer vs integer)");
+                return [f](const greg_t* r) -> bool {
+                    return f(cast<std::tuple_element_t<Is, Ps>>(r[regs[Is]])...);
+                };
+            }
+        }
+
+        // Typed predicate for syscall N, eg.
+        //   invp::on<SYS_pwrite64>(
+        //       [](int fd, const void* buf, size_t n, off_t off) {...})
+        // Parameters must match the syscall's arity and argument kinds (refer
+        // sysfail_syscalls.hh), this is checked at compile time.
+        template <Syscall N, typename F>
+        InvocationPredicate on(F f) {
+            constexpr auto i = syscalls::info(N);
+            static_assert(i != nullptr, "Unknown syscall");
+            using Ps = typename detail::Params<F>::T;
+            static_assert(
+                std::tuple_size_v<Ps> == i->arity(),
+                "Predicate must take exactly as many parameters as the "
+                "syscall takes arguments");
+            return detail::on<N, F, Ps>(
+                std::move(f),
+                std::make_index_sequence<std::tuple_size_v<Ps>>{});
+        }
+    }
+
+    // Declarative alternative to invocation predicates. Rules over syscall
+    // arguments are compiled into a flat program when the session starts and
+    // evaluated directly over registers, which is much cheaper than calling a
+    // predicate. Eg.
+    //   using namespace sysfail::match;
+    //   arg(1) == 7 || arg(1).in({9, 10})
+    //   arg(2).any_of(O_DIRECT) && arg(3) != 0
+    namespace match {
+        struct Rule {
+            enum class Kind { Eq, Ne, In, Range, AnyOf, AllOf, And, Or };
+
+            Kind kind;
+            // 1-based argument position, for argument conditions
+            int arg;
+            // Eq / Ne: value, In: set, Range: [lo, hi], AnyOf / AllOf: mask
+            std::vector<invp::A> values;
+            // And / Or: operands
+            std::vector<Rule> rules;
+
+            // Matches every invocation
+            Rule() : kind(Kind::And), arg(0) {}
+        };
+
+        // Argument of a syscall, used to build conditions
+        class Arg {
+            int n;
+
+            Rule cond(Rule::Kind k, std::vector<invp::A> values) const;
+
+        public:
+            // n in [1, 6], throws std::invalid_argument otherwise
+            explicit Arg(int n);
+
+            Rule operator==(invp::A v) const;
+            Rule operator!=(invp::A v) const;
+            Rule in(std::vector<invp::A> set) const;
+            // Inclusive, signed comparison
+            Rule between(invp::A lo, invp::A hi) const;
+            // Some / all bits of the mask are set
+            Rule any_of(invp::A mask) const;
+            Rule all_of(invp::A mask) const;
+        };
+
+        inline Arg arg(int n) {
+            return Arg(n);
+        }
+
+        Rule all(std::vector<Rule> rules);
+        Rule any(std::vector<Rule> rules);
+        Rule operator&&(Rule a, Rule b);
+        Rule operator||(Rule a, Rule b);
+    }
+
+    // Distributions for injected delays, parameters in microseconds (but
+    // for shapes). Samples are sub-microsecond precise, below 0 they count as
+    // 0 and above Outcome::max_delay (unless 0) as max_delay. Eg. a disk
+    // that's mostly fine but occasionally stalls:
+    //   latency::Bimodal{0.01, latency::LogNormal{200us, 0.3},
+    //                          latency::Pareto{5ms, 1.5}}
+    namespace latency {
+        using us = std::chrono::duration<double, std::micro>;
+
+        // Uniform in [0, Outcome::max_delay], the default
+        struct UpToMax {};
+
+        struct Constant {
+            us value;
+        };
+
+        // Uniform in [lo, hi]
+        struct Uniform {
+            us lo;
+            us hi;
+        };
+
+        struct Exponential {
+            us mean;
+        };
+
+        struct Normal {
+            us mean;
+            us stddev;
+        };
+
+        // exp(N(ln(median), sigma))
+        struct LogNormal {
+            us median;
+            double sigma;
+        };
+
+        // Heavy tail starting at `scale`, P(X > x) = (scale / x)^shape. The
+        // smaller the shape the heavier the tail (the mean is infinite for
+        // shape <= 1).
+        struct Pareto {
+            us scale;
+            double shape;
+        };
+
+        using Mode = std::variant<
+            UpToMax, Constant, Uniform, Exponential, Normal, LogNormal, Pareto>;
+
+        // `slow` with probability p, `fast` otherwise
+        struct Bimodal {
+            double p;
+            Mode fast;
+            Mode slow;
+        };
+
+        using Distribution = std::variant<
+            UpToMax, Constant, Uniform, Exponential, Normal, LogNormal, Pareto,
+            Bimodal>;
+
+        // Delays are capped at Outcome::max_delay, or at this if it is 0, so
+        // that a heavy tail can't stall a thread for good
+        const std::chrono::hours uncapped_max{1};
     }
 
     /**
@@ -103,10 +301,17 @@ namespace sysfail {
         // Errors to be presented to the call=site when failure is injected
         // and relative weights. Higher weight makes the error more likely. This
         // does not affect the probability of failure, only the distribution of
-        // errors when the syscall fails.
+        // errors when the syscall fails. Weights must be non-negative and not
+        // all 0 (Session throws std::invalid_argument otherwise).
         const std::map<Errno, double> error_weights;
         // Eligibility predicate for the syscall
         InvocationPredicate eligible;
+        // Argument rule for the syscall, checked before `eligible`. Both must
+        // pass for the call to be failure-injected.
+        const match::Rule args = {};
+        // Distribution delays are drawn from. Session throws
+        // std::invalid_argument for invalid parameters.
+        const latency::Distribution latency = latency::UpToMax{};
     };
 
     namespace thread_discovery {
@@ -121,15 +326,164 @@ namespace sysfail {
         // such as add / remove / discover can also be used in conjunction with
         // automatic discovery.
         struct ProcPoll {
+            // Poll interval, the shortest one if adaptive
             const std::chrono::microseconds itvl;
+            // Longest poll interval, same as itvl unless adaptive
+            const std::chrono::microseconds max_itvl;
+
+            ProcPoll( std::chrono::microseconds itvl = 10ms) :
+                itvl(itvl),
+                max_itvl(itvl) {}
+
+            // Adaptive polling. The interval drops to `min` whenever a poll
+            // finds threads spawned or terminated and doubles, up to `max`,
+            // with every poll that finds the threads unchanged. Throws
+            // std::invalid_argument unless 0 < min <= max.
+            ProcPoll(
+                std::chrono::microseconds min,
+                std::chrono::microseconds max
+            ) : itvl(min), max_itvl(max) {
+                if (min <= 0us || min > max) {
+                    throw std::invalid_argument(
+                        "ProcPoll needs 0 < min interval <= max interval");
+                }
+            }
+        };
+
+        // Threads running when the session starts are discovered by a single
+        // poll, threads spawned later by enrolled threads are enrolled
+        // synchronously: the spawned thread enrolls itself (subject to the
+        // selector) before returning from clone, so none of its code runs
+        // un-injected, and nothing polls. Caveats:
+        //  * threads spawned by threads that aren't enrolled, or that are
+        //    suspended / paused (refer Session::pause), are not discovered,
+        //    use add / discover_threads for those.
+        //  * the selector runs on the spawned thread before libc has finished
+        //    setting it up, it must not depend on thread-specific libc state.
+        //  * not available with seccomp dispatch (Session throws
+        //    std::invalid_argument).
+        struct OnClone {};
 
-            ProcPoll( std::chrono::microseconds itvl = 10ms) : itvl(itvl) {}
+        // Subscribe to the kernel's process events (netlink proc connector)
+        // and discover threads as they are spawned / terminate, rather than
+        // on the next poll. Subscribing only works in the initial user and
+        // pid namespace, and before Linux 6.6 needs CAP_NET_ADMIN. Where it
+        // doesn't, threads are discovered by polling as configured by
+        // `fallback` (Stats::itvl tells which).
+        struct ProcConnector {
+            const ProcPoll fallback;
+
+            ProcConnector(ProcPoll fallback = ProcPoll{}) :
+                fallback(fallback) {}
         };
 
         // Strategy for thread discovery
-        using Strategy = std::variant<ProcPoll, None>;
+        using Strategy = std::variant<ProcPoll, None, OnClone, ProcConnector>;
+
+        // Cost and latency of thread discovery so far, refer
+        // Session::discovery_stats
+        struct Stats {
+            // Polls (periodic and on-demand) of the process' threads
+            uint64_t polls = 0;
+            // CPU time spent polling (and processing proc-connector events)
+            std::chrono::nanoseconds poll_cpu{0};
+            // Threads found spawned
+            uint64_t spawned = 0;
+            // How long spawned threads ran undiscovered. For a poll it is
+            // the time since the poll before it (an upper bound), for a
+            // proc-connector event the time since the kernel sent it. Max
+            // and mean over the polls / events that found any.
+            std::chrono::microseconds max_latency{0};
+            std::chrono::microseconds mean_latency{0};
+            // Current poll interval, 0 unless polling periodically
+            std::chrono::microseconds itvl{0};
+        };
+    }
+
+    namespace syscall_dispatch {
+        // Syscall-user-dispatch (SUD). Every syscall made by an enrolled
+        // thread is trapped and then checked against the plan. Injection can
+        // be turned on and off for a thread any number of times.
+        struct SUD {};
+
+        // Seccomp-BPF filter that traps only the planned syscalls, all other
+        // syscalls run at native speed. Caveats:
+        //  * seccomp filters can't be removed, once a thread is enrolled the
+        //    planned syscalls (not others) keep trapping (and are passed
+        //    through) even after the thread is removed or the session ends.
+        //    Threads spawned by an enrolled thread inherit the filter too.
+        //  * filters accumulate: enrolling a thread stacks another filter on
+        //    it unless the ones it already has trap every planned syscall.
+        //    Later sessions planning the same syscalls (or fewer) reuse the
+        //    filters, but each one planning a syscall not trapped before adds
+        //    a filter, which slows every syscall the thread makes a little
+        //    and counts towards the kernel's limit on filter instructions
+        //    per thread (enrolling fails with ENOMEM once it is reached).
+        //  * enrolling a thread sets no_new_privs on it (required by seccomp
+        //    for unprivileged processes).
+        //  * planned syscalls made while libc has SIGSYS blocked (eg. clone
+        //    while spawning threads) are fatal, avoid planning such syscalls
+        //    in this mode.
+        struct Seccomp {};
+
+        // SUD, but the syscall instruction that trapped is rewritten so that
+        // later syscalls made from the same site reach sysfail with a plain
+        // call instead of a signal (sites are restored when the session
+        // ends). Caveats:
+        //  * needs a trampoline mapped at address 0, so it requires
+        //    vm.mmap_min_addr = 0 or CAP_SYS_RAWIO. Sysfail falls back to
+        //    plain SUD if the mapping is not permitted. The trampoline is
+        //    execute-only where the CPU has protection keys, elsewhere
+        //    null-pointer reads (not writes) won't fault while a session
+        //    with this mode is live. It is unmapped when the last one ends,
+        //    unless other threads are still running then (any of them could
+        //    be on the trampoline, eg. in a signal handler that interrupted
+        //    it there), in which case a later session ending unmaps it.
+        //  * the rewritten site pushes a return address, which clobbers 8
+        //    bytes of the caller's red zone.
+        //  * syscall numbers must be in [0, 4080) at rewritten sites.
+        struct Rewrite {};
+
+        // Mechanism used to intercept syscalls
+        using Mode = std::variant<SUD, Seccomp, Rewrite>;
     }
 
+    /**
+     * How injected delays are carried out. Sysfail sleeps (clock_nanosleep,
+     * made by sysfail itself, so never failure-injected) until `spin` before
+     * the delay ends and busy-waits on the TSC for the rest. Sleeps wake up
+     * late by the thread's timer slack (50us by default) plus scheduling
+     * latency, the spin absorbs that. A longer spin makes delays more precise
+     * and costs more CPU, delays shorter than it are spun in full. Spinning
+     * is off by default: the CPU a delayed thread spins on is taken from the
+     * threads it shares CPUs with, which then slow down too (eg. 100us spins
+     * make a delay-heavy thread noticeably slow others on a single CPU).
+     */
+    struct Delays {
+        std::chrono::microseconds spin{0};
+        // Timer slack (PR_SET_TIMERSLACK) for threads while they are
+        // enrolled, 0 leaves it alone. A small slack allows a shorter spin.
+        std::chrono::nanoseconds timer_slack{0};
+    };
+
+    struct ActivePlan;
+
+    // Plan compiled into what sessions run off (outcome tables, probability
+    // thresholds, error samplers), refer Plan::compile. It never changes, so
+    // sessions (one after another, on any thread) can share it and start
+    // without doing any work for the plan.
+    class CompiledPlan {
+        std::shared_ptr<const ActivePlan> p;
+
+    public:
+        explicit CompiledPlan(std::shared_ptr<const ActivePlan> p) :
+            p(std::move(p)) {}
+
+        const ActivePlan& operator*() const {
+            return *p;
+        }
+    };
+
     /**
      * Plan for failure injection
      */
@@ -140,20 +494,38 @@ namespace sysfail {
         const std::function<bool(pid_t)> selector;
         // Strategy for thread discovery
         const thread_discovery::Strategy thd_disc;
+        // Mechanism for intercepting syscalls
+        const syscall_dispatch::Mode dispatch;
+        // How delays are carried out
+        const Delays delays;
 
         Plan(
             const std::unordered_map<Syscall, const Outcome>& outcomes,
             const std::function<bool(pid_t)>& selector,
-            const thread_discovery::Strategy& thd_disc
-        ) : outcomes(outcomes), selector(selector), thd_disc(thd_disc) {}
+            const thread_discovery::Strategy& thd_disc,
+            const syscall_dispatch::Mode& dispatch = syscall_dispatch::SUD{},
+            const Delays& delays = {}
+        ) : outcomes(outcomes),
+            selector(selector),
+            thd_disc(thd_disc),
+            dispatch(dispatch),
+            delays(delays) {}
         Plan(const Plan& plan):
             outcomes(plan.outcomes),
             selector(plan.selector),
-            thd_disc(plan.thd_disc) {}
+            thd_disc(plan.thd_disc),
+            dispatch(plan.dispatch),
+            delays(plan.delays) {}
         Plan() :
             outcomes({}),
             selector([](pid_t) { return false; }),
-            thd_disc(thread_discovery::None{}) {}
+            thd_disc(thread_discovery::None{}),
+            dispatch(syscall_dispatch::SUD{}),
+            delays() {}
+
+        // Compile the plan for sessions to share. Throws
+        // std::invalid_argument for a plan a Session would reject.
+        CompiledPlan compile() const;
     };
 
     /**
@@ -162,6 +534,15 @@ namespace sysfail {
      * Plan controls the failure and delay injection behavior while APIs on the
      * session allow test / application to control behavior at thread or
      * process level.
+     *
+     * Enrolled threads are removed as they exit. With seccomp dispatch exits
+     * are only noticed by thread discovery.
+     *
+     * A child forked (with fork / pthread_atfork-aware APIs) while a session
+     * is live carries on with the same plan, with only the forking thread
+     * enrolled (if it was in the parent), its generator reseeded and thread
+     * discovery restarted. The fork waits for Session calls in progress on
+     * other threads to finish.
      */
     class Session {
         std::shared_mutex lck;
@@ -172,6 +553,9 @@ namespace sysfail {
         // or manual controls are first presented to the selector predicate and
         // failure-injected only if the predicate returns true.
         explicit Session(const Plan& plan);
+        // Same, for a compiled plan (refer Plan::compile). The session holds
+        // a reference to it.
+        explicit Session(CompiledPlan plan);
         // Stop failure / delay injection and terminate the session.
         ~Session();
         // Enable failure / delay injection for the calling thread.
@@ -182,10 +566,71 @@ namespace sysfail {
         void add(pid_t tid);
         // Disable failure / delay injection for the thread with the given tid.
         void remove(pid_t tid);
+        // Enable failure / delay injection for the given threads. All threads
+        // are signalled before waiting on any of them, so this costs about
+        // one signal round-trip rather than one per thread.
+        void add(std::span<const pid_t> tids);
+        // Disable failure / delay injection for the given threads, batched
+        // like add.
+        void remove(std::span<const pid_t> tids);
+        // Stop failure / delay injection for all enrolled threads without
+        // removing them, until resume. This only flips a flag per thread (no
+        // syscalls / signals), so it takes effect at the thread's next
+        // syscall and costs nanoseconds per thread. Threads added while paused
+        // stay paused. Paused threads keep trapping syscalls (like enrolled
+        // ones with unplanned syscalls), so that sysfail keeps track of their
+        // signal mask.
+        void pause();
+        // Resume failure / delay injection for all enrolled threads, but the
+        // suspended ones.
+        void resume();
+        // Like pause, for one enrolled thread. A suspended thread stays so
+        // across pause / resume, until unsuspended or removed. Scopes on the
+        // thread override suspension.
+        void suspend(pid_t tid);
+        // Undo suspend, the thread injects again unless the session is paused.
+        void unsuspend(pid_t tid);
+        // suspend / unsuspend for the calling thread
+        void suspend();
+        void unsuspend();
         // Discover threads on-demand. This can be used by the test /
         // application to trigger a single isolated poll to discover threads and
         // can be used regardless of the thread-discovery strategy in the plan.
         void discover_threads();
+        // Cost / latency of thread discovery so far, to tune ProcPoll.
+        thread_discovery::Stats discovery_stats();
+    };
+
+    struct ThdState;
+
+    /**
+     * Scope injects failures / delays into the calling thread for its
+     * lifetime even if the thread is suspended. Suspending an enrolled thread
+     * and opening Scopes around the code of interest confines injection to
+     * that code, eg.
+     *   session.suspend();
+     *   ...
+     *   void Compactor::flush() {
+     *       sysfail::Scope s;
+     *       ...
+     *   }
+     * Outside Scopes nothing is injected. Opening and closing a Scope makes
+     * no syscalls, Scopes nest. It has no effect on threads that aren't
+     * enrolled or while the session is paused.
+     */
+    class Scope {
+        ThdState* st;
+
+    public:
+        Scope();
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        // Scope without the guard, every enter must be paired with an exit
+        // on the same thread (in LIFO order with other Scopes)
+        static ThdState* enter();
+        static void exit(ThdState* st);
     };
 }
 
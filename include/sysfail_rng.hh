@@ -0,0 +1,83 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SYSFAIL_RNG_HH
+#define _SYSFAIL_RNG_HH
+
+#include <cstdint>
+
+namespace sysfail {
+    // Probability in [0, 1] as an integer threshold for Rng::chance. 63 bits
+    // so that both 0 (never) and 1 (always) are exact.
+    using Threshold = uint64_t;
+
+    constexpr Threshold threshold(double p) {
+        if (p <= 0) return 0;
+        if (p >= 1) return 1UL << 63;
+        return static_cast<Threshold>(p * 0x1p63);
+    }
+
+    // xoshiro256** (Blackman & Vigna), seeded by splitmix64. Cheap enough to
+    // draw several numbers per trapped syscall, and has no lazy init (seeded
+    // when a thread is enrolled, outside of signal handlers).
+    class Rng {
+        uint64_t s[4];
+
+        static uint64_t rotl(uint64_t x, int k) {
+            return (x << k) | (x >> (64 - k));
+        }
+
+    public:
+        Rng() : Rng(0) {}
+
+        explicit Rng(uint64_t seed) {
+            this->seed(seed);
+        }
+
+        void seed(uint64_t seed) {
+            for (auto& w : s) {
+                auto z = (seed += 0x9e3779b97f4a7c15UL);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+                w = z ^ (z >> 31);
+            }
+        }
+
+        uint64_t next() {
+            auto r = rotl(s[1] * 5, 7) * 9;
+            auto t = s[1] << 17;
+            s[2] ^= s[0];
+            s[3] ^= s[1];
+            s[1] ^= s[2];
+            s[0] ^= s[3];
+            s[2] ^= t;
+            s[3] = rotl(s[3], 45);
+            return r;
+        }
+
+        // True with the probability `t` stands for (refer `threshold`)
+        bool chance(Threshold t) {
+            return (next() >> 1) < t;
+        }
+
+        // Uniform in [0, n)
+        uint64_t below(uint64_t n) {
+            return (static_cast<unsigned __int128>(next()) * n) >> 64;
+        }
+    };
+}
+
+#endif
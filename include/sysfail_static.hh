@@ -0,0 +1,286 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SYSFAIL_STATIC_HH
+#define _SYSFAIL_STATIC_HH
+
+#include <array>
+#include <chrono>
+#include <span>
+#include <type_traits>
+#include <signal.h>
+
+#include "sysfail.hh"
+#include "sysfail_rng.hh"
+
+namespace sysfail {
+    // Failure / delay chosen for a syscall
+    struct Injection {
+        std::chrono::nanoseconds delay{0};
+        std::chrono::nanoseconds delay_after{0};
+        // Fail without making the syscall
+        Errno fail = 0;
+        // Make the syscall, then fail it
+        Errno fail_after = 0;
+        // Tail of the delays spun rather than slept, refer Delays
+        std::chrono::microseconds spin{0};
+
+        // Carries out the injection (used by sysfail). Delays / failures
+        // after the syscall are skipped when the thread makes the syscall
+        // itself (refer continue_syscall).
+        void apply(greg_t* regs) const;
+    };
+
+    // Decides what to inject into a syscall, given the thread's generator
+    using Decide = void (*)(const greg_t* regs, Rng& rng, Injection& inj);
+
+    /**
+     * Plan whose outcomes are known at compile time, eg.
+     *   using namespace sysfail::static_plan;
+     *   using P = sysfail::StaticPlan<
+     *       Rule<SYS_write, Fail<0.1>, Error<EIO, 3>, Error<ENOSPC>>,
+     *       Rule<SYS_fsync, Fail<0.5, 1>, Error<EIO>, Delay<0.2, 1000>>>;
+     *   sysfail::Session s(P::compile(selector, thread_discovery::None{}));
+     *
+     * Rules are the compile-time counterpart of Outcomes. Sessions decide
+     * what to inject with a function generated for the plan: a switch on the
+     * syscall number over the rules, with thresholds and error tables
+     * computed at compile time and predicates inlined, rather than an
+     * outcome lookup and std::function calls.
+     */
+    namespace static_plan {
+        struct FailTag {};
+        struct DelayTag {};
+        struct ErrorTag {};
+        struct WhereTag {};
+
+        // Probability and bias of failure, refer Probability. Probabilities
+        // and weights below can be given as integers or floating point.
+        template <auto P, auto AfterBias = 0>
+        struct Fail {
+            static_assert(P >= 0 && P <= 1, "Probability must be in [0, 1]");
+            static_assert(
+                AfterBias >= 0 && AfterBias <= 1,
+                "Bias must be in [0, 1]");
+            using tag = FailTag;
+            static constexpr Threshold at = threshold(P);
+            static constexpr Threshold after_at = threshold(AfterBias);
+        };
+
+        // Probability and bias of delay, and the maximum delay
+        template <auto P, uint32_t MaxUsec, auto AfterBias = 0>
+        struct Delay {
+            static_assert(P >= 0 && P <= 1, "Probability must be in [0, 1]");
+            static_assert(
+                AfterBias >= 0 && AfterBias <= 1,
+                "Bias must be in [0, 1]");
+            using tag = DelayTag;
+            static constexpr Threshold at = threshold(P);
+            static constexpr Threshold after_at = threshold(AfterBias);
+            static constexpr uint64_t max_usec = MaxUsec;
+        };
+
+        // Error presented when the syscall fails, with its relative weight
+        template <Errno E, auto Weight = 1>
+        struct Error {
+            static_assert(Weight >= 0, "Error weight must be non-negative");
+            using tag = ErrorTag;
+            static constexpr Errno err = E;
+            static constexpr double weight = static_cast<double>(Weight);
+        };
+
+        // Invocation predicate, a captureless lambda (or other constexpr
+        // callable) taking the registers, eg.
+        //   Where<[](const greg_t* r) { return r[REG_RDI] == 2; }>
+        // (a `>` in the lambda ends the template argument list, write it as
+        // `<` the other way around)
+        // All of a rule's predicates must pass for the call to be injected.
+        template <auto Pred>
+        struct Where {
+            using tag = WhereTag;
+            static bool holds(const greg_t* regs) {
+                return Pred(regs);
+            }
+        };
+
+        namespace detail {
+            template <typename Tag, typename Default, typename... Ps>
+            struct Find {
+                using type = Default;
+            };
+            template <typename Tag, typename Default, typename P, typename... Ps>
+            struct Find<Tag, Default, P, Ps...> : std::conditional_t<
+                std::is_same_v<typename P::tag, Tag>,
+                std::type_identity<P>,
+                Find<Tag, Default, Ps...>> {};
+
+            template <typename Tag, typename... Ps>
+            constexpr size_t count = (std::is_same_v<typename Ps::tag, Tag> + ... + 0);
+
+            template <typename P>
+            bool holds(const greg_t* regs) {
+                if constexpr (std::is_same_v<typename P::tag, WhereTag>) {
+                    return P::holds(regs);
+                } else {
+                    return true;
+                }
+            }
+        }
+
+        // Outcome of syscall N, made of at most one Fail and one Delay, any
+        // number of Errors and Wheres
+        template <Syscall N, typename... Parts>
+        struct Rule {
+            static_assert(syscalls::info(N) != nullptr, "Unknown syscall");
+            static_assert(
+                detail::count<FailTag, Parts...> <= 1 &&
+                detail::count<DelayTag, Parts...> <= 1,
+                "At most one Fail and one Delay per rule");
+
+            static constexpr Syscall nr = N;
+
+            using F = typename detail::Find<FailTag, Fail<0>, Parts...>::type;
+            using D = typename detail::Find<DelayTag, Delay<0, 0>, Parts...>::type;
+
+            static constexpr size_t n_errors = detail::count<ErrorTag, Parts...>;
+            static_assert(
+                F::at == 0 || n_errors > 0,
+                "A rule that fails needs at least one Error");
+
+            // Errors and the cumulative threshold up to which each is picked
+            struct ErrorTable {
+                std::array<Errno, n_errors> errs{};
+                std::array<Threshold, n_errors> upto{};
+            };
+
+            static constexpr ErrorTable errors = [] {
+                ErrorTable t;
+                std::array<double, n_errors> w{};
+                size_t i = 0;
+                double total = 0;
+                ([&] {
+                    if constexpr (std::is_same_v<typename Parts::tag, ErrorTag>) {
+                        t.errs[i] = Parts::err;
+                        w[i++] = Parts::weight;
+                        total += Parts::weight;
+                    }
+                }(), ...);
+                if (total == 0) return t;
+                double sum = 0;
+                for (size_t j = 0; j < n_errors; j++) {
+                    sum += w[j];
+                    t.upto[j] = threshold(sum / total);
+                }
+                return t;
+            }();
+
+            static_assert(
+                n_errors == 0 || errors.upto[n_errors - 1] != 0,
+                "Error weights must not all be 0");
+
+            static Errno pick(uint64_t r) {
+                auto x = r >> 1;
+                for (size_t i = 0; i + 1 < n_errors; i++) {
+                    if (x < errors.upto[i]) return errors.errs[i];
+                }
+                return errors.errs[n_errors - 1];
+            }
+
+            static bool eligible(const greg_t* regs) {
+                return (detail::holds<Parts>(regs) && ...);
+            }
+
+            // Same decision as for the equivalent Outcome, draws for
+            // probabilities that are 0 are skipped
+            static void decide(const greg_t* regs, Rng& rng, Injection& inj) {
+                if (! eligible(regs)) return;
+
+                if constexpr (D::at != 0) {
+                    if (rng.chance(D::at)) {
+                        auto delay = std::chrono::microseconds(
+                            rng.below(D::max_usec + 1));
+                        if (rng.chance(D::after_at)) {
+                            inj.delay_after = delay;
+                        } else {
+                            inj.delay = delay;
+                        }
+                    }
+                }
+                if constexpr (F::at != 0) {
+                    if (rng.chance(F::at)) {
+                        auto e = pick(rng.next());
+                        if (rng.chance(F::after_at)) {
+                            inj.fail_after = e;
+                        } else {
+                            inj.fail = e;
+                        }
+                    }
+                }
+            }
+        };
+
+        // Compiles a plan that decides with `decide` for the syscalls in
+        // `calls`. Selector, discovery and dispatch are taken from `p`, its
+        // outcomes are ignored. Throws std::invalid_argument like
+        // Plan::compile.
+        CompiledPlan compile(
+            const Plan& p,
+            std::span<const Syscall> calls,
+            Decide decide);
+    }
+
+    template <typename... Rules>
+    class StaticPlan {
+        static constexpr bool distinct() {
+            std::array<Syscall, sizeof...(Rules)> c{Rules::nr...};
+            for (size_t i = 0; i < c.size(); i++) {
+                for (size_t j = i + 1; j < c.size(); j++) {
+                    if (c[i] == c[j]) return false;
+                }
+            }
+            return true;
+        }
+        static_assert(distinct(), "At most one Rule per syscall");
+
+    public:
+        static constexpr std::array<Syscall, sizeof...(Rules)> calls{
+            Rules::nr...};
+
+        // Comparisons against the rules' constant syscall numbers, which the
+        // compiler turns into a switch
+        static void decide(const greg_t* regs, Rng& rng, Injection& inj) {
+            auto call = regs[REG_RAX];
+            (void) ((call == Rules::nr &&
+                (Rules::decide(regs, rng, inj), true)) || ...);
+        }
+
+        // Compile the plan for sessions (refer Plan::compile), the rest of
+        // the plan is as in Plan.
+        static CompiledPlan compile(
+            const std::function<bool(pid_t)>& selector,
+            const thread_discovery::Strategy& thd_disc,
+            const syscall_dispatch::Mode& dispatch = syscall_dispatch::SUD{},
+            const Delays& delays = {}
+        ) {
+            return static_plan::compile(
+                Plan({}, selector, thd_disc, dispatch, delays),
+                calls,
+                &decide);
+        }
+    };
+}
+
+#endif
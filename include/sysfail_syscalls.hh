@@ -0,0 +1,464 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SYSFAIL_SYSCALLS_HH
+#define _SYSFAIL_SYSCALLS_HH
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// x86_64 syscall metadata, usable at compile time.
+namespace sysfail::syscalls {
+    // Syscall number (same as sysfail::Syscall)
+    using Nr = int;
+
+    // Coarse argument kind, as the kernel declares the argument
+    enum class ArgKind : uint8_t {
+        Int, // integers, flags, fds, sizes, offsets (and some addresses, eg.
+             // mmap's addr is an unsigned long)
+        Ptr  // user pointers
+    };
+
+    struct Info {
+        Nr nr;
+        std::string_view name;
+        // One character per argument, 'i' => ArgKind::Int, 'p' => ArgKind::Ptr
+        std::string_view kinds;
+
+        constexpr size_t arity() const {
+            return kinds.size();
+        }
+
+        constexpr ArgKind arg(size_t i) const {
+            return kinds[i] == 'p' ? ArgKind::Ptr : ArgKind::Int;
+        }
+    };
+
+    // Sorted by syscall number. Argument kinds follow the kernel's syscall
+    // definitions (as described by its syscall tracepoints). Syscalls the
+    // kernel doesn't implement take no arguments here.
+    inline constexpr Info table[] = {
+        {0, "read", "ipi"},
+        {1, "write", "ipi"},
+        {2, "open", "pii"},
+        {3, "close", "i"},
+        {4, "stat", "pp"},
+        {5, "fstat", "ip"},
+        {6, "lstat", "pp"},
+        {7, "poll", "pii"},
+        {8, "lseek", "iii"},
+        {9, "mmap", "iiiiii"},
+        {10, "mprotect", "iii"},
+        {11, "munmap", "ii"},
+        {12, "brk", "i"},
+        {13, "rt_sigaction", "ippi"},
+        {14, "rt_sigprocmask", "ippi"},
+        {15, "rt_sigreturn", ""},
+        {16, "ioctl", "iii"},
+        {17, "pread64", "ipii"},
+        {18, "pwrite64", "ipii"},
+        {19, "readv", "ipi"},
+        {20, "writev", "ipi"},
+        {21, "access", "pi"},
+        {22, "pipe", "p"},
+        {23, "select", "ipppp"},
+        {24, "sched_yield", ""},
+        {25, "mremap", "iiiii"},
+        {26, "msync", "iii"},
+        {27, "mincore", "iip"},
+        {28, "madvise", "iii"},
+        {29, "shmget", "iii"},
+        {30, "shmat", "ipi"},
+        {31, "shmctl", "iip"},
+        {32, "dup", "i"},
+        {33, "dup2", "ii"},
+        {34, "pause", ""},
+        {35, "nanosleep", "pp"},
+        {36, "getitimer", "ip"},
+        {37, "alarm", "i"},
+        {38, "setitimer", "ipp"},
+        {39, "getpid", ""},
+        {40, "sendfile", "iipi"},
+        {41, "socket", "iii"},
+        {42, "connect", "ipi"},
+        {43, "accept", "ipp"},
+        {44, "sendto", "ipiipi"},
+        {45, "recvfrom", "ipiipp"},
+        {46, "sendmsg", "ipi"},
+        {47, "recvmsg", "ipi"},
+        {48, "shutdown", "ii"},
+        {49, "bind", "ipi"},
+        {50, "listen", "ii"},
+        {51, "getsockname", "ipp"},
+        {52, "getpeername", "ipp"},
+        {53, "socketpair", "iiip"},
+        {54, "setsockopt", "iiipi"},
+        {55, "getsockopt", "iiipp"},
+        {56, "clone", "iippi"},
+        {57, "fork", ""},
+        {58, "vfork", ""},
+        {59, "execve", "ppp"},
+        {60, "exit", "i"},
+        {61, "wait4", "ipip"},
+        {62, "kill", "ii"},
+        {63, "uname", "p"},
+        {64, "semget", "iii"},
+        {65, "semop", "ipi"},
+        {66, "semctl", "iiii"},
+        {67, "shmdt", "p"},
+        {68, "msgget", "ii"},
+        {69, "msgsnd", "ipii"},
+        {70, "msgrcv", "ipiii"},
+        {71, "msgctl", "iip"},
+        {72, "fcntl", "iii"},
+        {73, "flock", "ii"},
+        {74, "fsync", "i"},
+        {75, "fdatasync", "i"},
+        {76, "truncate", "pi"},
+        {77, "ftruncate", "ii"},
+        {78, "getdents", "ipi"},
+        {79, "getcwd", "pi"},
+        {80, "chdir", "p"},
+        {81, "fchdir", "i"},
+        {82, "rename", "pp"},
+        {83, "mkdir", "pi"},
+        {84, "rmdir", "p"},
+        {85, "creat", "pi"},
+        {86, "link", "pp"},
+        {87, "unlink", "p"},
+        {88, "symlink", "pp"},
+        {89, "readlink", "ppi"},
+        {90, "chmod", "pi"},
+        {91, "fchmod", "ii"},
+        {92, "chown", "pii"},
+        {93, "fchown", "iii"},
+        {94, "lchown", "pii"},
+        {95, "umask", "i"},
+        {96, "gettimeofday", "pp"},
+        {97, "getrlimit", "ip"},
+        {98, "getrusage", "ip"},
+        {99, "sysinfo", "p"},
+        {100, "times", "p"},
+        {101, "ptrace", "iiii"},
+        {102, "getuid", ""},
+        {103, "syslog", "ipi"},
+        {104, "getgid", ""},
+        {105, "setuid", "i"},
+        {106, "setgid", "i"},
+        {107, "geteuid", ""},
+        {108, "getegid", ""},
+        {109, "setpgid", "ii"},
+        {110, "getppid", ""},
+        {111, "getpgrp", ""},
+        {112, "setsid", ""},
+        {113, "setreuid", "ii"},
+        {114, "setregid", "ii"},
+        {115, "getgroups", "ip"},
+        {116, "setgroups", "ip"},
+        {117, "setresuid", "iii"},
+        {118, "getresuid", "ppp"},
+        {119, "setresgid", "iii"},
+        {120, "getresgid", "ppp"},
+        {121, "getpgid", "i"},
+        {122, "setfsuid", "i"},
+        {123, "setfsgid", "i"},
+        {124, "getsid", "i"},
+        {125, "capget", "ii"},
+        {126, "capset", "ii"},
+        {127, "rt_sigpending", "pi"},
+        {128, "rt_sigtimedwait", "pppi"},
+        {129, "rt_sigqueueinfo", "iip"},
+        {130, "rt_sigsuspend", "pi"},
+        {131, "sigaltstack", "pp"},
+        {132, "utime", "pp"},
+        {133, "mknod", "pii"},
+        {134, "uselib", "p"},
+        {135, "personality", "i"},
+        {136, "ustat", "ip"},
+        {137, "statfs", "pp"},
+        {138, "fstatfs", "ip"},
+        {139, "sysfs", "iii"},
+        {140, "getpriority", "ii"},
+        {141, "setpriority", "iii"},
+        {142, "sched_setparam", "ip"},
+        {143, "sched_getparam", "ip"},
+        {144, "sched_setscheduler", "iip"},
+        {145, "sched_getscheduler", "i"},
+        {146, "sched_get_priority_max", "i"},
+        {147, "sched_get_priority_min", "i"},
+        {148, "sched_rr_get_interval", "ip"},
+        {149, "mlock", "ii"},
+        {150, "munlock", "ii"},
+        {151, "mlockall", "i"},
+        {152, "munlockall", ""},
+        {153, "vhangup", ""},
+        {154, "modify_ldt", "ipi"},
+        {155, "pivot_root", "pp"},
+        {156, "_sysctl", "p"},
+        {157, "prctl", "iiiii"},
+        {158, "arch_prctl", "ii"},
+        {159, "adjtimex", "p"},
+        {160, "setrlimit", "ip"},
+        {161, "chroot", "p"},
+        {162, "sync", ""},
+        {163, "acct", "p"},
+        {164, "settimeofday", "pp"},
+        {165, "mount", "pppip"},
+        {166, "umount2", "pi"},
+        {167, "swapon", "pi"},
+        {168, "swapoff", "p"},
+        {169, "reboot", "iiip"},
+        {170, "sethostname", "pi"},
+        {171, "setdomainname", "pi"},
+        {172, "iopl", "i"},
+        {173, "ioperm", "iii"},
+        {174, "create_module", ""}, // not implemented
+        {175, "init_module", "pip"},
+        {176, "delete_module", "pi"},
+        {177, "get_kernel_syms", ""}, // not implemented
+        {178, "query_module", ""}, // not implemented
+        {179, "quotactl", "ipip"},
+        {180, "nfsservctl", ""}, // not implemented
+        {181, "getpmsg", ""}, // not implemented
+        {182, "putpmsg", ""}, // not implemented
+        {183, "afs_syscall", ""}, // not implemented
+        {184, "tuxcall", ""}, // not implemented
+        {185, "security", ""}, // not implemented
+        {186, "gettid", ""},
+        {187, "readahead", "iii"},
+        {188, "setxattr", "pppii"},
+        {189, "lsetxattr", "pppii"},
+        {190, "fsetxattr", "ippii"},
+        {191, "getxattr", "pppi"},
+        {192, "lgetxattr", "pppi"},
+        {193, "fgetxattr", "ippi"},
+        {194, "listxattr", "ppi"},
+        {195, "llistxattr", "ppi"},
+        {196, "flistxattr", "ipi"},
+        {197, "removexattr", "pp"},
+        {198, "lremovexattr", "pp"},
+        {199, "fremovexattr", "ip"},
+        {200, "tkill", "ii"},
+        {201, "time", "p"},
+        {202, "futex", "piippi"},
+        {203, "sched_setaffinity", "iip"},
+        {204, "sched_getaffinity", "iip"},
+        {205, "set_thread_area", "p"},
+        {206, "io_setup", "ip"},
+        {207, "io_destroy", "i"},
+        {208, "io_getevents", "iiipp"},
+        {209, "io_submit", "iip"},
+        {210, "io_cancel", "ipp"},
+        {211, "get_thread_area", "p"},
+        {212, "lookup_dcookie", "ipi"},
+        {213, "epoll_create", "i"},
+        {214, "epoll_ctl_old", ""}, // not implemented
+        {215, "epoll_wait_old", ""}, // not implemented
+        {216, "remap_file_pages", "iiiii"},
+        {217, "getdents64", "ipi"},
+        {218, "set_tid_address", "p"},
+        {219, "restart_syscall", ""},
+        {220, "semtimedop", "ipip"},
+        {221, "fadvise64", "iiii"},
+        {222, "timer_create", "ipp"},
+        {223, "timer_settime", "iipp"},
+        {224, "timer_gettime", "ip"},
+        {225, "timer_getoverrun", "i"},
+        {226, "timer_delete", "i"},
+        {227, "clock_settime", "ip"},
+        {228, "clock_gettime", "ip"},
+        {229, "clock_getres", "ip"},
+        {230, "clock_nanosleep", "iipp"},
+        {231, "exit_group", "i"},
+        {232, "epoll_wait", "ipii"},
+        {233, "epoll_ctl", "iiip"},
+        {234, "tgkill", "iii"},
+        {235, "utimes", "pp"},
+        {236, "vserver", ""}, // not implemented
+        {237, "mbind", "iiipii"},
+        {238, "set_mempolicy", "ipi"},
+        {239, "get_mempolicy", "ppiii"},
+        {240, "mq_open", "piip"},
+        {241, "mq_unlink", "p"},
+        {242, "mq_timedsend", "ipiip"},
+        {243, "mq_timedreceive", "ipipp"},
+        {244, "mq_notify", "ip"},
+        {245, "mq_getsetattr", "ipp"},
+        {246, "kexec_load", "iipi"},
+        {247, "waitid", "iipip"},
+        {248, "add_key", "pppii"},
+        {249, "request_key", "pppi"},
+        {250, "keyctl", "iiiii"},
+        {251, "ioprio_set", "iii"},
+        {252, "ioprio_get", "ii"},
+        {253, "inotify_init", ""},
+        {254, "inotify_add_watch", "ipi"},
+        {255, "inotify_rm_watch", "ii"},
+        {256, "migrate_pages", "iipp"},
+        {257, "openat", "ipii"},
+        {258, "mkdirat", "ipi"},
+        {259, "mknodat", "ipii"},
+        {260, "fchownat", "ipiii"},
+        {261, "futimesat", "ipp"},
+        {262, "newfstatat", "ippi"},
+        {263, "unlinkat", "ipi"},
+        {264, "renameat", "ipip"},
+        {265, "linkat", "ipipi"},
+        {266, "symlinkat", "pip"},
+        {267, "readlinkat", "ippi"},
+        {268, "fchmodat", "ipi"},
+        {269, "faccessat", "ipi"},
+        {270, "pselect6", "ippppp"},
+        {271, "ppoll", "pippi"},
+        {272, "unshare", "i"},
+        {273, "set_robust_list", "pi"},
+        {274, "get_robust_list", "ipp"},
+        {275, "splice", "ipipii"},
+        {276, "tee", "iiii"},
+        {277, "sync_file_range", "iiii"},
+        {278, "vmsplice", "ipii"},
+        {279, "move_pages", "iipppi"},
+        {280, "utimensat", "ippi"},
+        {281, "epoll_pwait", "ipiipi"},
+        {282, "signalfd", "ipi"},
+        {283, "timerfd_create", "ii"},
+        {284, "eventfd", "i"},
+        {285, "fallocate", "iiii"},
+        {286, "timerfd_settime", "iipp"},
+        {287, "timerfd_gettime", "ip"},
+        {288, "accept4", "ippi"},
+        {289, "signalfd4", "ipii"},
+        {290, "eventfd2", "ii"},
+        {291, "epoll_create1", "i"},
+        {292, "dup3", "iii"},
+        {293, "pipe2", "pi"},
+        {294, "inotify_init1", "i"},
+        {295, "preadv", "ipiii"},
+        {296, "pwritev", "ipiii"},
+        {297, "rt_tgsigqueueinfo", "iiip"},
+        {298, "perf_event_open", "piiii"},
+        {299, "recvmmsg", "ipiip"},
+        {300, "fanotify_init", "ii"},
+        {301, "fanotify_mark", "iiiip"},
+        {302, "prlimit64", "iipp"},
+        {303, "name_to_handle_at", "ipppi"},
+        {304, "open_by_handle_at", "ipi"},
+        {305, "clock_adjtime", "ip"},
+        {306, "syncfs", "i"},
+        {307, "sendmmsg", "ipii"},
+        {308, "setns", "ii"},
+        {309, "getcpu", "ppp"},
+        {310, "process_vm_readv", "ipipii"},
+        {311, "process_vm_writev", "ipipii"},
+        {312, "kcmp", "iiiii"},
+        {313, "finit_module", "ipi"},
+        {314, "sched_setattr", "ipi"},
+        {315, "sched_getattr", "ipii"},
+        {316, "renameat2", "ipipi"},
+        {317, "seccomp", "iip"},
+        {318, "getrandom", "pii"},
+        {319, "memfd_create", "pi"},
+        {320, "kexec_file_load", "iiipi"},
+        {321, "bpf", "ipi"},
+        {322, "execveat", "ipppi"},
+        {323, "userfaultfd", "i"},
+        {324, "membarrier", "iii"},
+        {325, "mlock2", "iii"},
+        {326, "copy_file_range", "ipipii"},
+        {327, "preadv2", "ipiiii"},
+        {328, "pwritev2", "ipiiii"},
+        {329, "pkey_mprotect", "iiii"},
+        {330, "pkey_alloc", "ii"},
+        {331, "pkey_free", "i"},
+        {332, "statx", "ipiip"},
+        {333, "io_pgetevents", "iiippp"},
+        {334, "rseq", "piii"},
+        {424, "pidfd_send_signal", "iipi"},
+        {425, "io_uring_setup", "ip"},
+        {426, "io_uring_enter", "iiiipi"},
+        {427, "io_uring_register", "iipi"},
+        {428, "open_tree", "ipi"},
+        {429, "move_mount", "ipipi"},
+        {430, "fsopen", "pi"},
+        {431, "fsconfig", "iippi"},
+        {432, "fsmount", "iii"},
+        {433, "fspick", "ipi"},
+        {434, "pidfd_open", "ii"},
+        {435, "clone3", "pi"},
+        {436, "close_range", "iii"},
+        {437, "openat2", "ippi"},
+        {438, "pidfd_getfd", "iii"},
+        {439, "faccessat2", "ipii"},
+        {440, "process_madvise", "ipiii"},
+        {441, "epoll_pwait2", "ipippi"},
+        {442, "mount_setattr", "ipipi"},
+        {443, "quotactl_fd", "iiip"},
+        {444, "landlock_create_ruleset", "pii"},
+        {445, "landlock_add_rule", "iipi"},
+        {446, "landlock_restrict_self", "ii"},
+        {447, "memfd_secret", "i"},
+        {448, "process_mrelease", "ii"},
+        {449, "futex_waitv", "piipi"},
+        {450, "set_mempolicy_home_node", "iiii"},
+        {451, "cachestat", "ippi"},
+        {452, "fchmodat2", "ipii"},
+        {453, "map_shadow_stack", "iii"},
+        {454, "futex_wake", "piii"},
+        {455, "futex_wait", "piiipi"},
+        {456, "futex_requeue", "piii"},
+        {457, "statmount", "ppii"},
+        {458, "listmount", "ppii"},
+        {459, "lsm_get_self_attr", "ippi"},
+        {460, "lsm_set_self_attr", "ipii"},
+        {461, "lsm_list_modules", "ppi"},
+        {462, "mseal", "iii"},
+        {463, "setxattrat", "ipippi"},
+        {464, "getxattrat", "ipippi"},
+        {465, "listxattrat", "ipipi"},
+        {466, "removexattrat", "ipip"},
+        {467, "open_tree_attr", "ipipi"},
+        {468, "file_getattr", "ippii"},
+        {469, "file_setattr", "ippii"},
+    };
+
+    // Metadata for the syscall, nullptr if the number is unknown
+    constexpr const Info* info(Nr nr) {
+        size_t lo = 0, hi = std::size(table);
+        while (lo < hi) {
+            auto mid = (lo + hi) / 2;
+            if (table[mid].nr == nr) return &table[mid];
+            if (table[mid].nr < nr) lo = mid + 1; else hi = mid;
+        }
+        return nullptr;
+    }
+
+    // Name of the syscall (eg. "pwrite64"), empty if the number is unknown
+    constexpr std::string_view name(Nr nr) {
+        auto i = info(nr);
+        return i ? i->name : std::string_view();
+    }
+
+    // Number of the named syscall, if any
+    constexpr std::optional<Nr> number(std::string_view name) {
+        for (const auto& i : table) {
+            if (i.name == name) return i.nr;
+        }
+        return std::nullopt;
+    }
+}
+
+#endif
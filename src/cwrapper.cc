@@ -42,9 +42,30 @@ extern "C" {
         }
     }
 
-    sysfail_session_t* sysfail_start(const sysfail_plan_t *c_plan) {
-        if (!c_plan) return nullptr;
+    static latency::Mode to_mode(const sysfail_latency_dist_t& d) {
+        latency::us p1{d.p1}, p2{d.p2};
+        switch (d.kind) {
+            case sysfail_latency_up_to_max: return latency::UpToMax{};
+            case sysfail_latency_constant: return latency::Constant{p1};
+            case sysfail_latency_uniform: return latency::Uniform{p1, p2};
+            case sysfail_latency_exponential: return latency::Exponential{p1};
+            case sysfail_latency_normal: return latency::Normal{p1, p2};
+            case sysfail_latency_lognormal: return latency::LogNormal{p1, d.p2};
+            case sysfail_latency_pareto: return latency::Pareto{p1, d.p2};
+        }
+        throw std::invalid_argument("Unknown latency kind");
+    }
 
+    static latency::Distribution to_latency(const sysfail_latency_t& l) {
+        if (l.p_alt > 0) {
+            return latency::Bimodal{l.p_alt, to_mode(l.mode), to_mode(l.alt)};
+        }
+        return std::visit(
+            [](auto m) -> latency::Distribution { return m; },
+            to_mode(l.mode));
+    }
+
+    static sysfail::Plan to_plan(const sysfail_plan_t *c_plan) {
         std::unordered_map<Syscall, const Outcome> outcomes;
         for (auto o = c_plan->syscall_outcomes; o != nullptr; o = o->next) {
             std::map<Errno, double> error_weights;
@@ -64,7 +85,9 @@ extern "C" {
                 ](const greg_t* regs) -> bool {
                     if (!e) return true;
                     return e(ctx, regs);
-                }};
+                },
+                {},
+                to_latency(o->outcome.latency)};
             outcomes.insert({o->syscall, outcome});
         }
         auto selector = [
@@ -82,6 +105,13 @@ extern "C" {
                     case sysfail_tdisk_poll:
                         return thread_discovery::ProcPoll(
                             std::chrono::microseconds(c_plan->config.poll_itvl_usec));
+                    case sysfail_tdisc_on_clone:
+                        return thread_discovery::OnClone{};
+                    case sysfail_tdisc_proc_connector:
+                        return thread_discovery::ProcConnector(
+                            thread_discovery::ProcPoll(
+                                std::chrono::microseconds(
+                                    c_plan->config.poll_itvl_usec)));
                     default:
                         std::cerr << "Invalid thread discovery strategy, "
                                   << "defaulting to `none`" << std::endl;
@@ -89,10 +119,26 @@ extern "C" {
                 }
             }()};
 
-        auto session = new sysfail::Session({
-            outcomes,
-            selector,
-            tdisc_strategy});
+        syscall_dispatch::Mode dispatch{
+            [&]() -> syscall_dispatch::Mode {
+                switch (c_plan->dispatch) {
+                    case sysfail_dispatch_sud:
+                        return syscall_dispatch::SUD{};
+                    case sysfail_dispatch_seccomp:
+                        return syscall_dispatch::Seccomp{};
+                    case sysfail_dispatch_rewrite:
+                        return syscall_dispatch::Rewrite{};
+                    default:
+                        std::cerr << "Invalid syscall dispatch mode, "
+                                  << "defaulting to `sud`" << std::endl;
+                        return syscall_dispatch::SUD{};
+                }
+            }()};
+
+        return {outcomes, selector, tdisc_strategy, dispatch};
+    }
+
+    static sysfail_session_t* wrap(sysfail::Session* session) {
         return new sysfail_session_t{
             .data = session,
             .stop = [](sysfail_session_t* s) {
@@ -113,6 +159,73 @@ extern "C" {
             },
             .discover_threads = [](sysfail_session_t* s) {
                 static_cast<sysfail::Session*>(s->data)->discover_threads();
+            },
+            .add_threads = [](
+                sysfail_session_t* s,
+                const sysfail_tid_t* tids,
+                size_t count
+            ) {
+                static_cast<sysfail::Session*>(s->data)->add(
+                    std::span(tids, count));
+            },
+            .remove_threads = [](
+                sysfail_session_t* s,
+                const sysfail_tid_t* tids,
+                size_t count
+            ) {
+                static_cast<sysfail::Session*>(s->data)->remove(
+                    std::span(tids, count));
+            },
+            .pause = [](sysfail_session_t* s) {
+                static_cast<sysfail::Session*>(s->data)->pause();
+            },
+            .resume = [](sysfail_session_t* s) {
+                static_cast<sysfail::Session*>(s->data)->resume();
+            },
+            .suspend_thread = [](sysfail_session_t* s, sysfail_tid_t tid) {
+                static_cast<sysfail::Session*>(s->data)->suspend(tid);
+            },
+            .unsuspend_thread = [](sysfail_session_t* s, sysfail_tid_t tid) {
+                static_cast<sysfail::Session*>(s->data)->unsuspend(tid);
+            },
+            .suspend_this_thread = [](sysfail_session_t* s) {
+                static_cast<sysfail::Session*>(s->data)->suspend();
+            },
+            .unsuspend_this_thread = [](sysfail_session_t* s) {
+                static_cast<sysfail::Session*>(s->data)->unsuspend();
+            },
+            .enter_scope = [](sysfail_session_t*) -> sysfail_scope_t {
+                return sysfail::Scope::enter();
+            },
+            .exit_scope = [](sysfail_session_t*, sysfail_scope_t scope) {
+                sysfail::Scope::exit(static_cast<sysfail::ThdState*>(scope));
             }};
     }
+
+    sysfail_session_t* sysfail_start(const sysfail_plan_t *c_plan) {
+        if (!c_plan) return nullptr;
+        return wrap(new sysfail::Session(to_plan(c_plan)));
+    }
+
+    struct sysfail_compiled_plan_s {
+        sysfail::CompiledPlan plan;
+    };
+
+    sysfail_compiled_plan_t* sysfail_plan_compile(
+        const sysfail_plan_t *c_plan
+    ) {
+        if (!c_plan) return nullptr;
+        return new sysfail_compiled_plan_t{to_plan(c_plan).compile()};
+    }
+
+    void sysfail_compiled_plan_free(sysfail_compiled_plan_t* c_plan) {
+        delete c_plan;
+    }
+
+    sysfail_session_t* sysfail_start_compiled(
+        const sysfail_compiled_plan_t* c_plan
+    ) {
+        if (!c_plan) return nullptr;
+        return wrap(new sysfail::Session(c_plan->plan));
+    }
 }
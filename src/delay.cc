@@ -0,0 +1,121 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <mutex>
+#include <cerrno>
+#include <ctime>
+#include <cpuid.h>
+#include <x86intrin.h>
+#include <sys/syscall.h>
+
+#include "delay.hh"
+#include "syscall.hh"
+
+namespace {
+    // TSC ticks per nanosecond in 32.32 fixed point, 0 to poll the clock
+    std::atomic<uint64_t> tsc_per_ns = 0;
+
+    uint64_t now_ns() {
+        timespec ts;
+        sysfail::syscall(
+            CLOCK_MONOTONIC,
+            reinterpret_cast<uint64_t>(&ts),
+            0,
+            0,
+            0,
+            0,
+            SYS_clock_gettime);
+        return ts.tv_sec * 1'000'000'000UL + ts.tv_nsec;
+    }
+
+    // Clock and TSC read together, the TSC read is the midpoint of two that
+    // bracket the clock read
+    std::pair<uint64_t, uint64_t> now_and_tsc() {
+        auto before = __rdtsc();
+        auto ns = now_ns();
+        auto after = __rdtsc();
+        return {ns, before + (after - before) / 2};
+    }
+
+    bool invariant_tsc() {
+        unsigned a, b, c, d;
+        return __get_cpuid(0x80000007, &a, &b, &c, &d) && (d & (1 << 8));
+    }
+}
+
+void sysfail::delay::calibrate() {
+    static std::once_flag once;
+    std::call_once(once, [] {
+        if (! invariant_tsc()) return;
+
+        auto [ns0, tsc0] = now_and_tsc();
+        timespec ts{0, 1'000'000};
+        while (sysfail::syscall(
+            CLOCK_MONOTONIC,
+            0,
+            reinterpret_cast<uint64_t>(&ts),
+            reinterpret_cast<uint64_t>(&ts),
+            0,
+            0,
+            SYS_clock_nanosleep) == -EINTR) {}
+        auto [ns1, tsc1] = now_and_tsc();
+
+        auto q = (static_cast<unsigned __int128>(tsc1 - tsc0) << 32) /
+            (ns1 - ns0);
+        tsc_per_ns.store(static_cast<uint64_t>(q));
+    });
+}
+
+uint64_t sysfail::delay::tsc_hz() {
+    return (static_cast<unsigned __int128>(tsc_per_ns.load()) *
+        1'000'000'000) >> 32;
+}
+
+void sysfail::delay::sleep(
+    std::chrono::nanoseconds dur,
+    std::chrono::nanoseconds spin
+) {
+    if (dur.count() <= 0) return;
+    auto q = tsc_per_ns.load(std::memory_order_relaxed);
+    auto tsc0 = __rdtsc();
+    auto ticks = (static_cast<unsigned __int128>(dur.count()) * q) >> 32;
+
+    uint64_t deadline = 0;
+    if (dur > spin || q == 0) {
+        deadline = now_ns() + dur.count();
+    }
+    if (dur > spin) {
+        auto wake = deadline - spin.count();
+        timespec ts{
+            static_cast<time_t>(wake / 1'000'000'000),
+            static_cast<long>(wake % 1'000'000'000)};
+        while (sysfail::syscall(
+            CLOCK_MONOTONIC,
+            TIMER_ABSTIME,
+            reinterpret_cast<uint64_t>(&ts),
+            0,
+            0,
+            0,
+            SYS_clock_nanosleep) == -EINTR) {}
+    }
+
+    if (q == 0) {
+        while (now_ns() < deadline) _mm_pause();
+        return;
+    }
+    while (__rdtsc() - tsc0 < ticks) _mm_pause();
+}
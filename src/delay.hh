@@ -0,0 +1,44 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DELAY_HH
+#define _DELAY_HH
+
+#include <chrono>
+#include <cstdint>
+
+namespace sysfail::delay {
+    // Injected delays are carried out without libc, whose sleeps may be
+    // failure-injected themselves. The thread sleeps with clock_nanosleep
+    // (TIMER_ABSTIME, so interruptions resume towards the same deadline),
+    // made from sysfail's own text and so never trapped, until `spin` before
+    // the deadline. It spins on the TSC for the rest, which absorbs timer
+    // slack and wake-up latency.
+    //
+    // The TSC is calibrated against CLOCK_MONOTONIC once per process, by
+    // calibrate. Without an invariant TSC the spin polls the clock instead.
+
+    // Not signal-safe, takes about a millisecond the first time
+    void calibrate();
+
+    // TSC ticks per second, 0 if the TSC isn't used (or not calibrated yet)
+    uint64_t tsc_hz();
+
+    // Async-signal-safe
+    void sleep(std::chrono::nanoseconds dur, std::chrono::nanoseconds spin);
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <memory>
+#include <thread>
+
+#include "epoch.hh"
+
+using namespace std::chrono_literals;
+
+namespace {
+    // 1-based index of the calling thread's slot, 0 until it first reads
+    [[gnu::tls_model("initial-exec")]]
+    thread_local uint32_t thd_slot = 0;
+}
+
+sysfail::Epoch::Slot& sysfail::Epoch::slot() {
+    if (thd_slot == 0) {
+        thd_slot = next_slot.fetch_add(1, std::memory_order_relaxed)
+            % slots.size() + 1;
+    }
+    return slots[thd_slot - 1];
+}
+
+sysfail::Epoch::Reader::Reader(Epoch& e) {
+    auto g = e.gen.load(std::memory_order_relaxed) & 1;
+    active = &e.slot().active[g];
+    // Orders the pointer load that follows after the increment, so either
+    // synchronize() sees this reader or the reader sees the unpublished
+    // pointer.
+    active->fetch_add(1, std::memory_order_seq_cst);
+}
+
+void sysfail::Epoch::forget_readers() {
+    for (auto& s : slots) {
+        s.active[0].store(0);
+        s.active[1].store(0);
+    }
+    // May have been held by a thread that is gone
+    std::construct_at(&writer);
+}
+
+void sysfail::Epoch::drain(uint32_t g) {
+    for (auto& s : slots) {
+        while (s.active[g].load(std::memory_order_seq_cst) != 0) {
+            std::this_thread::sleep_for(10us);
+        }
+    }
+}
+
+void sysfail::Epoch::synchronize() {
+    std::lock_guard<std::mutex> l(writer);
+    // A reader that loaded gen just before a flip may count itself in the
+    // old generation after it has been drained, and then use whatever was
+    // still published. Draining the generation about to become current first
+    // waits out such readers of the previous synchronize(), the drain after
+    // the flip waits out the rest (as SRCU does).
+    auto g = gen.load(std::memory_order_seq_cst) & 1;
+    drain(g ^ 1);
+    gen.fetch_add(1, std::memory_order_seq_cst);
+    drain(g);
+}
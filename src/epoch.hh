@@ -0,0 +1,81 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _EPOCH_HH
+#define _EPOCH_HH
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+namespace sysfail {
+    // Read-side critical sections for data shared with signal handlers, in
+    // the style of sleepable RCU. A reader counts itself in a counter owned
+    // by its thread, so entering and leaving a section doesn't touch cache
+    // lines shared with other threads. A writer that has unpublished a
+    // pointer calls synchronize() to wait out the readers that may still be
+    // using it before freeing it.
+    //
+    // Counters come in two generations. synchronize() moves new readers to
+    // the other generation and waits for the previous one to drain, so a
+    // steady stream of readers can't hold it up (it drains the other one
+    // first, refer synchronize). Threads beyond the number of
+    // slots share them, which is still correct, just not contention free.
+    class Epoch {
+        struct alignas(64) Slot {
+            std::atomic<uint64_t> active[2] = {0, 0};
+        };
+
+        std::array<Slot, 64> slots;
+        std::atomic<uint32_t> gen;
+        std::atomic<uint32_t> next_slot;
+        std::mutex writer;
+
+        Slot& slot();
+
+        // Wait for the readers counted in generation g to leave
+        void drain(uint32_t g);
+
+    public:
+        // Read-side critical section, async-signal-safe. Pointers loaded
+        // (with seq_cst ordering) while it is alive stay valid until it ends.
+        // It must not be held across anything that may not return (eg.
+        // syscalls that block indefinitely, exit, sigreturn or code that may
+        // longjmp), as that stalls synchronize() for good.
+        class Reader {
+            std::atomic<uint64_t>* active;
+        public:
+            explicit Reader(Epoch& e);
+            ~Reader() {
+                active->fetch_sub(1, std::memory_order_release);
+            }
+            Reader(const Reader&) = delete;
+            Reader& operator=(const Reader&) = delete;
+        };
+
+        Epoch() : gen(0), next_slot(0) {}
+
+        // Wait for every read-side section that began before the call.
+        void synchronize();
+
+        // In a forked child, forgets the sections of threads that didn't
+        // make it to the child (the caller must not be in one).
+        void forget_readers();
+    };
+}
+
+#endif
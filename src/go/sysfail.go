@@ -170,6 +170,12 @@ const (
 	// ThreadDiscoveryPoll Poll to discover threads at regular intervals, manual controls can also
 	// be used in conjunction with automatic discovery.
 	ThreadDiscoveryPoll
+	// ThreadDiscoveryOnClone Threads spawned by enrolled threads enroll themselves as they
+	// start, no polling.
+	ThreadDiscoveryOnClone
+	// ThreadDiscoveryProcConnector Threads are discovered as the kernel reports them spawned,
+	// falling back to polling (at PollIntervalUsec) where that is unavailable.
+	ThreadDiscoveryProcConnector
 )
 
 // ThreadDiscoveryConfig is the configuration for thread discovery
@@ -252,6 +258,7 @@ func StartSession(plan *Plan) (*Session, error) {
 			curr.outcome.delay.p = C.double(outcome.Outcome.Delay.P)
 			curr.outcome.delay.after_bias = C.double(outcome.Outcome.Delay.AfterBias)
 			curr.outcome.max_delay_usec = C.uint(outcome.Outcome.MaxDelayUsec)
+			curr.outcome.latency = C.sysfail_latency_t{}
 			C.set_ctx(&curr.outcome, unsafe.Pointer(nil))
 			switch outcome.Outcome.Eligible.Type {
 			case CustomPredicate:
@@ -16,45 +16,85 @@
 
 #include "map.hh"
 
-#include <regex>
 #include <cassert>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <fcntl.h>
+#include <link.h>
+#include <unistd.h>
+
+namespace {
+    // Fields of a maps line are separated by single spaces, the path (if
+    // any) is padded to a column
+    std::string_view field(std::string_view& line) {
+        auto end = line.find(' ');
+        auto f = line.substr(0, end);
+        line.remove_prefix(end == line.npos ? line.size() : end + 1);
+        return f;
+    }
+
+    uintptr_t number(std::string_view f, int base) {
+        uintptr_t n = 0;
+        std::from_chars(f.data(), f.data() + f.size(), n, base);
+        return n;
+    }
+
+    bool read_all(const std::string& path, std::string& buf) {
+        auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        size_t len = 0;
+        buf.resize(64 * 1024);
+        for (;;) {
+            if (len == buf.size()) buf.resize(2 * buf.size());
+            auto n = read(fd, buf.data() + len, buf.size() - len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                close(fd);
+                buf.resize(len);
+                return n == 0;
+            }
+            len += n;
+        }
+    }
+
+    // Anchors libsysfail_text to the object this is linked into
+    void text_anchor() {}
+}
 
 std::optional<sysfail::Mapping> sysfail::get_mmap(pid_t pid) {
     Mapping mapping;
     std::string filePath = "/proc/" + std::to_string(pid) + "/maps";
-    std::ifstream mapsFile(filePath);
+    std::string buf;
 
-    if (!mapsFile.is_open()) {
-        std::cerr << "Failed to open " << filePath << "\n";
+    if (!read_all(filePath, buf)) {
+        std::cerr << "Failed to read " << filePath << "\n";
         return std::nullopt;
     }
 
-    std::string line;
-    while (std::getline(mapsFile, line)) {
-        std::istringstream iss(line);
-        uintptr_t startAddr, endAddr;
-        std::string permissions, offsetStr, devStr, path = "";
-        uintptr_t inode;
-
-        iss >> std::hex >> startAddr;
-        iss.ignore(1, '-');
-        iss >> std::hex >> endAddr;
-        iss >> permissions >> offsetStr >> devStr >> inode;
-
-        std::getline(iss, path);
-        // Trim leading spaces
-        if (!path.empty()) {
-            path.erase(0, path.find_first_not_of(' '));
-        }
+    std::string_view rest(buf);
+    while (! rest.empty()) {
+        auto eol = rest.find('\n');
+        auto line = rest.substr(0, eol);
+        rest.remove_prefix(eol == rest.npos ? rest.size() : eol + 1);
+        if (line.empty()) continue;
 
+        auto addrs = field(line);
+        auto dash = addrs.find('-');
         AddrRange info;
-        info.start = startAddr;
-        info.length = endAddr - startAddr;
-        info.permissions = permissions;
-        info.path = path;
-        info.inode = inode;
+        info.start = number(addrs.substr(0, dash), 16);
+        info.length = number(addrs.substr(dash + 1), 16) - info.start;
+        info.permissions = field(line);
+        field(line); // offset
+        field(line); // device
+        info.inode = number(field(line), 10);
+        auto path = line.find_first_not_of(' ');
+        if (path != line.npos) info.path = line.substr(path);
 
-        mapping.map[startAddr] = info;
+        mapping.ranges.push_back(std::move(info));
     }
 
     return mapping;
@@ -64,19 +104,42 @@ bool sysfail::AddrRange::executable() const {
     return permissions.find("x") != std::string::npos;
 }
 
+// [vdso], [vsyscall] etc
 bool sysfail::AddrRange::vdso() const {
-    std::regex vdsoRe(R"(^\[[a-zA-Z0-9]+\]$)");
-    return std::regex_match(path, vdsoRe);
+    return path.size() > 2 &&
+        path.front() == '[' &&
+        path.back() == ']' &&
+        std::all_of(path.begin() + 1, path.end() - 1, [](unsigned char c) {
+            return std::isalnum(c);
+        });
 }
 
+// .../libsysfail[.0-9]*.so[.0-9]*
 bool sysfail::AddrRange::libsysfail() const {
-    std::regex soRegex(R"(^.*/libsysfail[.0-9]+*\.so[.0-9]*$)");
-    return std::regex_match(path, soRegex);
+    auto is_ver = [](char c) { return c == '.' || std::isdigit(c); };
+
+    std::string_view name(path);
+    auto slash = name.rfind('/');
+    if (slash == name.npos) return false;
+    name.remove_prefix(slash + 1);
+    if (! name.starts_with("libsysfail")) return false;
+    name.remove_prefix(std::strlen("libsysfail"));
+
+    auto so = name.find(".so");
+    while (so != name.npos) {
+        auto before = name.substr(0, so), after = name.substr(so + 3);
+        if (std::all_of(before.begin(), before.end(), is_ver) &&
+            std::all_of(after.begin(), after.end(), is_ver)) {
+            return true;
+        }
+        so = name.find(".so", so + 1);
+    }
+    return false;
 }
 
 sysfail::AddrRange sysfail::Mapping::self_text() {
     std::vector<AddrRange> mappings;
-    for (const auto& [_, info] : map) {
+    for (const auto& info : ranges) {
         if (info.executable() && info.libsysfail()) {
             mappings.push_back(info);
         }
@@ -84,4 +147,58 @@ sysfail::AddrRange sysfail::Mapping::self_text() {
     assert(mappings.size() == 1);
 
     return mappings[0];
-}
\ No newline at end of file
+}
+
+const sysfail::AddrRange* sysfail::Mapping::find(uintptr_t addr) const {
+    auto it = std::upper_bound(
+        ranges.begin(),
+        ranges.end(),
+        addr,
+        [](uintptr_t a, const AddrRange& r) { return a < r.start; });
+    if (it == ranges.begin()) return nullptr;
+    --it;
+    if (addr - it->start >= it->length) return nullptr;
+    return &*it;
+}
+
+sysfail::AddrRange sysfail::libsysfail_text() {
+    struct {
+        uintptr_t anchor;
+        std::optional<AddrRange> text;
+    } ctx{reinterpret_cast<uintptr_t>(&text_anchor), std::nullopt};
+
+    dl_iterate_phdr([](dl_phdr_info* obj, size_t, void* data) -> int {
+        auto c = static_cast<decltype(ctx)*>(data);
+        for (int i = 0; i < obj->dlpi_phnum; i++) {
+            const auto& ph = obj->dlpi_phdr[i];
+            if (ph.p_type != PT_LOAD || ! (ph.p_flags & PF_X)) continue;
+
+            uintptr_t start = obj->dlpi_addr + ph.p_vaddr;
+            if (c->anchor < start || c->anchor >= start + ph.p_memsz) continue;
+
+            // Segments are mapped in whole pages
+            uintptr_t page_sz = sysconf(_SC_PAGESIZE);
+            uintptr_t end = (start + ph.p_memsz + page_sz - 1) & ~(page_sz - 1);
+            start &= ~(page_sz - 1);
+
+            AddrRange r;
+            r.start = start;
+            r.length = end - start;
+            r.permissions = {
+                ph.p_flags & PF_R ? 'r' : '-',
+                ph.p_flags & PF_W ? 'w' : '-',
+                'x',
+                'p'};
+            r.path = obj->dlpi_name;
+            r.inode = 0;
+            c->text = std::move(r);
+            return 1;
+        }
+        return 0;
+    }, &ctx);
+
+    if (! ctx.text) {
+        throw std::runtime_error("Couldn't find sysfail's text segment");
+    }
+    return *ctx.text;
+}
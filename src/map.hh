@@ -17,14 +17,11 @@
 #ifndef _MAP_HH
 #define _MAP_HH
 
-#include <iostream>
-#include <fstream>
-#include <sstream>
 #include <string>
-#include <map>
 #include <optional>
 #include <vector>
 #include <stdint.h>
+#include <sys/types.h>
 
 namespace sysfail {
     struct AddrRange {
@@ -40,12 +37,24 @@ namespace sysfail {
     };
 
     struct Mapping {
-        std::map<uintptr_t, AddrRange> map;
+        // Sorted by start address
+        std::vector<AddrRange> ranges;
+        // Syscall sites within these mappings that have been rewritten (refer
+        // rewrite.hh), so they can be restored.
+        std::vector<uintptr_t> patched;
 
         AddrRange self_text();
+
+        // Mapping the address belongs to, if any
+        const AddrRange* find(uintptr_t addr) const;
     };
 
     std::optional<Mapping> get_mmap(pid_t pid);
+
+    // Executable segment of the object sysfail is linked into (the same range
+    // as Mapping::self_text), found through the dynamic linker's list of
+    // loaded objects rather than by parsing the process' maps.
+    AddrRange libsysfail_text();
 }
 
-#endif
\ No newline at end of file
+#endif
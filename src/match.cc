@@ -0,0 +1,175 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdexcept>
+#include <string>
+
+#include "match.hh"
+
+namespace sysfail::match {
+    static const uint8_t arg_regs[] = {
+        REG_RDI, REG_RSI, REG_RDX, REG_R10, REG_R8, REG_R9
+    };
+
+    Arg::Arg(int n) : n(n) {
+        if (n < 1 || n > 6) {
+            throw std::invalid_argument(
+                "Syscall argument " + std::to_string(n) + " is out of range");
+        }
+    }
+
+    Rule Arg::cond(Rule::Kind k, std::vector<invp::A> values) const {
+        Rule r;
+        r.kind = k;
+        r.arg = n;
+        r.values = std::move(values);
+        return r;
+    }
+
+    Rule Arg::operator==(invp::A v) const {
+        return cond(Rule::Kind::Eq, {v});
+    }
+
+    Rule Arg::operator!=(invp::A v) const {
+        return cond(Rule::Kind::Ne, {v});
+    }
+
+    Rule Arg::in(std::vector<invp::A> set) const {
+        return cond(Rule::Kind::In, std::move(set));
+    }
+
+    Rule Arg::between(invp::A lo, invp::A hi) const {
+        if (lo > hi) throw std::invalid_argument("Empty argument range");
+        return cond(Rule::Kind::Range, {lo, hi});
+    }
+
+    Rule Arg::any_of(invp::A mask) const {
+        return cond(Rule::Kind::AnyOf, {mask});
+    }
+
+    Rule Arg::all_of(invp::A mask) const {
+        return cond(Rule::Kind::AllOf, {mask});
+    }
+
+    static Rule combine(Rule::Kind k, std::vector<Rule> rules) {
+        Rule r;
+        r.kind = k;
+        r.rules = std::move(rules);
+        return r;
+    }
+
+    Rule all(std::vector<Rule> rules) {
+        return combine(Rule::Kind::And, std::move(rules));
+    }
+
+    Rule any(std::vector<Rule> rules) {
+        return combine(Rule::Kind::Or, std::move(rules));
+    }
+
+    // Flattens nested operands of the same kind, so chains like
+    // a && b && c produce a single And.
+    static Rule join(Rule::Kind k, Rule a, Rule b) {
+        std::vector<Rule> rules;
+        for (auto* r : {&a, &b}) {
+            if (r->kind == k) {
+                for (auto& o : r->rules) rules.push_back(std::move(o));
+            } else {
+                rules.push_back(std::move(*r));
+            }
+        }
+        return combine(k, std::move(rules));
+    }
+
+    Rule operator&&(Rule a, Rule b) {
+        return join(Rule::Kind::And, std::move(a), std::move(b));
+    }
+
+    Rule operator||(Rule a, Rule b) {
+        return join(Rule::Kind::Or, std::move(a), std::move(b));
+    }
+
+    Program::Program(const Rule& r) : insns{}, len(0) {
+        entry = compile(r, accept, reject);
+    }
+
+    uint16_t Program::emit(const Insn& i) {
+        if (len == max_insns) {
+            throw std::invalid_argument(
+                "Argument rule needs more than " +
+                std::to_string(max_insns) + " instructions");
+        }
+        insns[len] = i;
+        return len++;
+    }
+
+    // Emits code that jumps to `t` if the rule matches and to `f` otherwise,
+    // returns its entry point. Operands are emitted last to first, so every
+    // jump target exists by the time it is referenced.
+    uint16_t Program::compile(const Rule& r, uint16_t t, uint16_t f) {
+        using K = Rule::Kind;
+
+        auto reg = [&]() -> uint8_t {
+            if (r.arg < 1 || r.arg > 6) {
+                throw std::invalid_argument(
+                    "Syscall argument " + std::to_string(r.arg) +
+                    " is out of range");
+            }
+            return arg_regs[r.arg - 1];
+        };
+        auto value = [&](size_t n) {
+            if (r.values.size() != n) {
+                throw std::invalid_argument("Malformed argument condition");
+            }
+            return r.values[0];
+        };
+
+        switch (r.kind) {
+            case K::Eq:
+                return emit({Insn::Eq, reg(), t, f, value(1), 0});
+            case K::Ne:
+                return emit({Insn::Eq, reg(), f, t, value(1), 0});
+            case K::Range:
+                return emit({Insn::Range, reg(), t, f, value(2), r.values[1]});
+            case K::AnyOf:
+                return emit({Insn::AnyOf, reg(), t, f, value(1), 0});
+            case K::AllOf:
+                return emit({Insn::AllOf, reg(), t, f, value(1), 0});
+            case K::In: {
+                auto rg = reg();
+                auto next = f;
+                for (auto v = r.values.rbegin(); v != r.values.rend(); v++) {
+                    next = emit({Insn::Eq, rg, t, next, *v, 0});
+                }
+                return next;
+            }
+            case K::And: {
+                auto next = t;
+                for (auto o = r.rules.rbegin(); o != r.rules.rend(); o++) {
+                    next = compile(*o, next, f);
+                }
+                return next;
+            }
+            case K::Or: {
+                auto next = f;
+                for (auto o = r.rules.rbegin(); o != r.rules.rend(); o++) {
+                    next = compile(*o, t, next);
+                }
+                return next;
+            }
+        }
+        throw std::invalid_argument("Unknown argument rule");
+    }
+}
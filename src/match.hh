@@ -0,0 +1,84 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MATCH_HH
+#define _MATCH_HH
+
+#include <array>
+#include <cstdint>
+#include <ucontext.h>
+
+#include "sysfail.hh"
+
+namespace sysfail::match {
+    // Single test on an argument register, jumps to `jt` or `jf`
+    struct Insn {
+        enum Op : uint8_t { Eq, Range, AnyOf, AllOf };
+
+        Op op;
+        uint8_t reg;
+        uint16_t jt;
+        uint16_t jf;
+        invp::A a;
+        invp::A b;
+    };
+
+    // Rule compiled to a branch program (in the spirit of classic BPF). Jumps
+    // only go backwards in `insns` (refer `compile`), the program is entered
+    // at `entry` and ends at `accept` or `reject`. Fixed size, so it can be
+    // stored inline and evaluated without touching the heap.
+    class Program {
+    public:
+        static const uint16_t max_insns = 32;
+        static const uint16_t accept = max_insns;
+        static const uint16_t reject = max_insns + 1;
+
+        // Throws std::invalid_argument for malformed rules or rules that
+        // don't fit in max_insns instructions.
+        explicit Program(const Rule& r);
+
+        bool operator()(const greg_t* regs) const {
+            auto pc = entry;
+            while (pc < max_insns) {
+                const auto& i = insns[pc];
+                auto x = regs[i.reg];
+                bool r;
+                switch (i.op) {
+                    case Insn::Eq: r = x == i.a; break;
+                    case Insn::Range: r = x >= i.a && x <= i.b; break;
+                    case Insn::AnyOf: r = (x & i.a) != 0; break;
+                    case Insn::AllOf: r = (x & i.a) == i.a; break;
+                }
+                pc = r ? i.jt : i.jf;
+            }
+            return pc == accept;
+        }
+
+        size_t size() const {
+            return len;
+        }
+
+    private:
+        std::array<Insn, max_insns> insns;
+        uint16_t len;
+        uint16_t entry;
+
+        uint16_t emit(const Insn& i);
+        uint16_t compile(const Rule& r, uint16_t t, uint16_t f);
+    };
+}
+
+#endif
@@ -0,0 +1,315 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <mutex>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "rewrite.hh"
+#include "syscall.hh"
+#include "helpers.hh"
+#include "log.hh"
+
+namespace {
+    const uint16_t syscall_insn = 0x050f;  // 0f 05: syscall
+    const uint16_t call_rax_insn = 0xd0ff; // ff d0: call *%rax
+
+    const uintptr_t page_sz = 4096;
+
+    // Syscall numbers beyond this land past the sled, which is fine because
+    // kernel doesn't have syscalls numbered anywhere close
+    const size_t sled_sz = page_sz - 16;
+
+    bool map_trampoline() {
+        auto ret = sysfail::syscall(
+            0,
+            page_sz,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE,
+            -1,
+            0,
+            SYS_mmap);
+        if (ret != 0) {
+            if (ret > 0) sysfail::syscall(ret, page_sz, 0, 0, 0, 0, SYS_munmap);
+            sysfail::log(
+                "Can't map syscall trampoline at 0 (%s), sites won't be "
+                "rewritten\n",
+                std::strerror(ret < 0 ? -ret : EEXIST));
+            return false;
+        }
+        auto* t = reinterpret_cast<uint8_t*>(ret);
+        std::memset(t, 0x90, sled_sz); // nop
+        auto entry = reinterpret_cast<uint64_t>(&sysfail_rewrite_entry);
+        uint8_t* j = t + sled_sz;
+        *j++ = 0x49; *j++ = 0xbb;      // movabs $entry, %r11
+        std::memcpy(j, &entry, sizeof(entry));
+        j += sizeof(entry);
+        *j++ = 0x41; *j++ = 0xff; *j++ = 0xe3; // jmp *%r11
+
+        // Exec-only: on x86 with protection keys the kernel backs this with an
+        // execute-only pkey, so null-pointer reads fault too. Elsewhere
+        // PROT_EXEC implies PROT_READ and only writes fault.
+        ret = sysfail::syscall(0, page_sz, PROT_EXEC, 0, 0, 0, SYS_mprotect);
+        if (ret != 0) {
+            sysfail::syscall(0, page_sz, 0, 0, 0, 0, SYS_munmap);
+            return false;
+        }
+        return true;
+    }
+
+    // Live Rewriters, the trampoline is mapped while there are any
+    std::mutex trampoline_mtx;
+    size_t trampoline_users = 0;
+    bool trampoline_mapped = false;
+
+    // Threads other than the caller
+    bool other_thds(std::vector<std::string>& dirs) {
+        auto self = std::to_string(gettid());
+        std::error_code ec;
+        for (auto& e : std::filesystem::directory_iterator(
+                 sysfail::tasks_dir, ec)) {
+            if (e.path().filename() != self) dirs.push_back(e.path());
+        }
+        return !ec;
+    }
+
+    // Whether the thread is gone or exiting (PF_EXITING, it never returns to
+    // userspace then)
+    bool thd_exited(const std::string& dir) {
+        const unsigned pf_exiting = 0x4;
+
+        char buf[512];
+        auto fd = open((dir + "/stat").c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return true;
+        auto n = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (n <= 0) return true;
+        buf[n] = '\0';
+        // comm (in parens) may contain anything, state and the rest follow
+        auto p = std::strrchr(buf, ')');
+        if (p == nullptr) return false;
+        std::string_view rest(p + 1);
+        // state ppid pgrp session tty_nr tpgid flags
+        for (int i = 0; i < 6; i++) {
+            rest.remove_prefix(std::min(rest.find(' ', 1), rest.size()));
+        }
+        unsigned flags = 0;
+        auto f = rest.substr(rest.empty() ? 0 : 1);
+        std::from_chars(f.data(), f.data() + f.size(), flags);
+        return flags & pf_exiting;
+    }
+
+    // Once the last sites are restored no thread enters the sled again, but
+    // a thread already on it may stay there for any length of time, eg. if
+    // a signal handler interrupted it on the sled and then blocks. Nothing
+    // short of unwinding its signal frames tells where such a thread will
+    // return to, so page 0 can only go once every other thread has exited.
+    bool trampoline_vacated() {
+        std::vector<std::string> others;
+        if (!other_thds(others)) return false;
+        return std::all_of(others.begin(), others.end(), thd_exited);
+    }
+
+    // Protection of the mapping addr is in as of now, -1 if addr isn't
+    // mapped. The maps snapshot sites were checked against may be stale (eg.
+    // the object was unloaded or its pages mprotect'ed since). Reads maps
+    // with raw syscalls into a stack buffer, it runs in signal handlers.
+    int current_prot(uintptr_t addr) {
+        auto fd = sysfail::syscall(
+            AT_FDCWD,
+            reinterpret_cast<uint64_t>("/proc/self/maps"),
+            O_RDONLY | O_CLOEXEC,
+            0,
+            0,
+            0,
+            SYS_openat);
+        if (fd < 0) return -1;
+
+        // Only the "start-end perms" a line starts with is needed, the rest
+        // of a line that doesn't fit the buffer (long path) is skipped
+        char buf[1024];
+        size_t len = 0;
+        bool skip = false;
+        bool done = false;
+        int ret = -1;
+        while (!done) {
+            auto n = sysfail::syscall(
+                fd,
+                reinterpret_cast<uint64_t>(buf + len),
+                sizeof(buf) - len,
+                0,
+                0,
+                0,
+                SYS_read);
+            if (n == -EINTR) continue;
+            if (n <= 0) break;
+            len += n;
+
+            char* line = buf;
+            char* end = buf + len;
+            while (!done && line < end) {
+                auto eol = static_cast<char*>(
+                    std::memchr(line, '\n', end - line));
+                // partial line, unless it fills the buffer
+                if (eol == nullptr && (line != buf || len < sizeof(buf))) {
+                    break;
+                }
+                auto last = eol == nullptr ? end : eol;
+                if (!skip) {
+                    uintptr_t lo = 0, hi = 0;
+                    auto r = std::from_chars(line, last, lo, 16);
+                    if (r.ptr < last) {
+                        r = std::from_chars(r.ptr + 1, last, hi, 16);
+                    }
+                    if (addr < lo) {
+                        done = true; // lines are sorted, so it isn't mapped
+                    } else if (addr < hi && r.ptr + 4 < last) {
+                        ret = 0;
+                        if (r.ptr[1] == 'r') ret |= PROT_READ;
+                        if (r.ptr[2] == 'w') ret |= PROT_WRITE;
+                        if (r.ptr[3] == 'x') ret |= PROT_EXEC;
+                        done = true;
+                    }
+                }
+                skip = eol == nullptr;
+                line = eol == nullptr ? end : eol + 1;
+            }
+            len = end - line;
+            std::memmove(buf, line, len);
+        }
+        sysfail::syscall(fd, 0, 0, 0, 0, 0, SYS_close);
+        return ret;
+    }
+
+    struct Busy {
+        std::atomic_flag& f;
+        bool acquired = false;
+
+        Busy(std::atomic_flag& f, bool wait) : f(f) {
+            do {
+                acquired = !f.test_and_set(std::memory_order_acquire);
+            } while (!acquired && wait);
+        }
+
+        ~Busy() {
+            if (acquired) f.clear(std::memory_order_release);
+        }
+    };
+}
+
+sysfail::Rewriter::Rewriter(Mapping&& m) : mapping(std::move(m)) {
+    // reserved upfront, patch is called from signal handlers
+    mapping.patched.reserve(max_sites);
+    demoted.reserve(max_sites);
+
+    std::lock_guard<std::mutex> l(trampoline_mtx);
+    trampoline_users++;
+    if (!trampoline_mapped) trampoline_mapped = map_trampoline();
+    trampoline = trampoline_mapped;
+}
+
+sysfail::Rewriter::~Rewriter() {
+    {
+        Busy b(busy, true);
+        for (auto site : mapping.patched) {
+            write(site, call_rax_insn, syscall_insn);
+        }
+        mapping.patched.clear();
+    }
+
+    std::lock_guard<std::mutex> l(trampoline_mtx);
+    if (--trampoline_users > 0 || !trampoline_mapped) return;
+    // Otherwise left for the next Rewriter to reuse (and unmap)
+    if (trampoline_vacated()) {
+        syscall(0, page_sz, 0, 0, 0, 0, SYS_munmap);
+        trampoline_mapped = false;
+    }
+}
+
+bool sysfail::Rewriter::available() {
+    std::lock_guard<std::mutex> l(trampoline_mtx);
+    if (trampoline_mapped) return true;
+    if (!map_trampoline()) return false;
+    // Nothing can be on it yet
+    syscall(0, page_sz, 0, 0, 0, 0, SYS_munmap);
+    return true;
+}
+
+bool sysfail::Rewriter::write(uintptr_t site, uint16_t from, uint16_t to) {
+    auto p = current_prot(site);
+    // Gone, eg. the object was unloaded
+    if (p < 0) return false;
+    // Sites don't straddle cache lines (see patch), so not pages either
+    auto pg = site & ~(page_sz - 1);
+    auto ret = syscall(
+        pg, page_sz, p | PROT_READ | PROT_WRITE, 0, 0, 0, SYS_mprotect);
+    if (ret != 0) return false;
+    // Both bytes are in the same cache line, so other threads see either the
+    // old or the new instruction. The site is left alone if it doesn't hold
+    // `from` (anymore), eg. the range was remapped and holds other code now.
+    auto ok = __atomic_compare_exchange_n(
+        reinterpret_cast<uint16_t*>(site),
+        &from,
+        to,
+        false,
+        __ATOMIC_SEQ_CST,
+        __ATOMIC_SEQ_CST);
+    syscall(pg, page_sz, p, 0, 0, 0, SYS_mprotect);
+    return ok;
+}
+
+bool sysfail::Rewriter::patch(uintptr_t site) {
+    if (!trampoline) return false;
+    if ((site & 63) == 63) return false; // straddles cache lines
+
+    Busy b(busy, false);
+    if (!b.acquired) return false;
+
+    if (mapping.patched.size() == max_sites) return false;
+    if (std::find(demoted.begin(), demoted.end(), site) != demoted.end()) {
+        return false;
+    }
+
+    auto r = mapping.find(site);
+    if (r == nullptr ||
+        ! r->executable() ||
+        r->path.starts_with("[") || // vdso, vsyscall etc
+        site + 2 > r->start + r->length) {
+        return false;
+    }
+
+    if (!write(site, syscall_insn, call_rax_insn)) return false;
+    mapping.patched.push_back(site);
+    return true;
+}
+
+void sysfail::Rewriter::demote(uintptr_t site) {
+    Busy b(busy, true);
+    auto p = std::find(mapping.patched.begin(), mapping.patched.end(), site);
+    if (p != mapping.patched.end()) {
+        write(site, call_rax_insn, syscall_insn);
+        mapping.patched.erase(p);
+    }
+    if (demoted.size() < max_sites) demoted.push_back(site);
+}
+
+size_t sysfail::Rewriter::patched() const {
+    return mapping.patched.size();
+}
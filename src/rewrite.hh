@@ -0,0 +1,84 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _REWRITE_HH
+#define _REWRITE_HH
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "map.hh"
+
+extern "C" {
+    // Entry point syscall sites are rewritten to reach (refer rewrite.S)
+    extern void sysfail_rewrite_entry();
+}
+
+namespace sysfail {
+    // Rewrites `syscall` instructions (0f 05) to `call *%rax` (ff d0), which
+    // slides down a nop-sled mapped at address 0 into sysfail_rewrite_entry.
+    // So once a site is rewritten, syscalls made from it are handled without
+    // a signal. Syscalls from sites that aren't rewritten still trap via SUD.
+    // The trampoline is mapped (execute-only where the CPU supports it) while
+    // any Rewriter is alive. The last one to be destroyed unmaps it if no
+    // other thread is left that could still be on the sled, so null-pointer
+    // dereferences fault again once sessions end. Otherwise it stays mapped
+    // until a later Rewriter gets to unmap it.
+    class Rewriter {
+        Mapping mapping;
+        // Sites that must stay syscall instructions (refer `demote`)
+        std::vector<uintptr_t> demoted;
+        std::atomic_flag busy = ATOMIC_FLAG_INIT;
+        // Whether the trampoline could be mapped, nothing is patched if not
+        bool trampoline = false;
+
+        // Replaces the instruction at `site` if it still is `from`, false if
+        // it isn't or the site is no longer mapped. The page keeps the
+        // protection it has now.
+        bool write(uintptr_t site, uint16_t from, uint16_t to);
+
+    public:
+        // Upper bound on sites patched (or demoted), further sites stay on SUD
+        static const size_t max_sites = 4096;
+
+        explicit Rewriter(Mapping&& m);
+
+        // Restores rewritten sites that are still mapped and still hold the
+        // rewritten instruction, the last Rewriter also unmaps the trampoline
+        // if it can (see above)
+        ~Rewriter();
+
+        // Whether the trampoline can be mapped, false if that isn't
+        // permitted (needs vm.mmap_min_addr = 0 or CAP_SYS_RAWIO).
+        static bool available();
+
+        // Rewrites the syscall instruction at `site`. This is best-effort,
+        // sites outside known mappings, sites in use by a concurrent rewrite,
+        // demoted sites etc are left alone. Returns true if the site was
+        // rewritten. Async-signal-safe.
+        bool patch(uintptr_t site);
+
+        // Restores the syscall instruction at `site` and makes sure it is never
+        // rewritten again. This is used for syscalls that can't be made from
+        // sysfail_rewrite_entry (eg. clone), which are made to trap instead.
+        void demote(uintptr_t site);
+
+        size_t patched() const;
+    };
+}
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <sys/prctl.h>
+#include <linux/seccomp.h>
+#include <linux/audit.h>
+
+#include "seccomp.hh"
+#include "syscall.hh"
+
+namespace {
+    // Union of syscalls trapped by filters installed on this thread (all of
+    // them stay in force) which let syscalls from sysfail's text (starting
+    // at covered_text) through
+    [[gnu::tls_model("initial-exec")]]
+    thread_local std::bitset<sysfail::seccomp_tracked_calls> covered;
+    [[gnu::tls_model("initial-exec")]]
+    thread_local uintptr_t covered_text = 0;
+
+    const uint32_t arch_off = offsetof(seccomp_data, arch);
+    const uint32_t nr_off = offsetof(seccomp_data, nr);
+    const uint32_t ip_lo_off = offsetof(seccomp_data, instruction_pointer);
+    const uint32_t ip_hi_off = ip_lo_off + 4;
+
+    sock_filter ld(uint32_t off) {
+        return BPF_STMT(BPF_LD | BPF_W | BPF_ABS, off);
+    }
+
+    sock_filter jmp(uint16_t op, uint32_t k, uint8_t jt, uint8_t jf) {
+        return BPF_JUMP(BPF_JMP | op | BPF_K, k, jt, jf);
+    }
+
+    sock_filter ret(uint32_t action) {
+        return BPF_STMT(BPF_RET | BPF_K, action);
+    }
+}
+
+sysfail::SeccompFilter::SeccompFilter(
+    const std::vector<Syscall>& calls,
+    const AddrRange& self_text
+) : tracked(true), text_start(self_text.start) {
+    uint64_t start = self_text.start;
+    uint64_t end = self_text.start + self_text.length;
+    uint32_t s_hi = start >> 32, s_lo = start;
+    uint32_t e_hi = end >> 32, e_lo = end;
+
+    prog = {
+        /*  0 */ ld(arch_off),
+        /*  1 */ jmp(BPF_JEQ, AUDIT_ARCH_X86_64, 1, 0),
+        /*  2 */ ret(SECCOMP_RET_ALLOW),
+        // ip >= start
+        /*  3 */ ld(ip_hi_off),
+        /*  4 */ jmp(BPF_JGT, s_hi, 3, 0),
+        /*  5 */ jmp(BPF_JEQ, s_hi, 0, 8),
+        /*  6 */ ld(ip_lo_off),
+        /*  7 */ jmp(BPF_JGE, s_lo, 0, 6),
+        // ip < end
+        /*  8 */ ld(ip_hi_off),
+        /*  9 */ jmp(BPF_JGT, e_hi, 4, 0),
+        /* 10 */ jmp(BPF_JEQ, e_hi, 0, 2),
+        /* 11 */ ld(ip_lo_off),
+        /* 12 */ jmp(BPF_JGE, e_lo, 1, 0),
+        // syscall made by sysfail
+        /* 13 */ ret(SECCOMP_RET_ALLOW),
+        // syscall made by anything else
+        /* 14 */ ld(nr_off),
+    };
+    for (auto call : calls) {
+        prog.push_back(jmp(BPF_JEQ, call, 0, 1));
+        prog.push_back(ret(SECCOMP_RET_TRAP));
+        if (call >= 0 && static_cast<size_t>(call) < traps.size()) {
+            traps.set(call);
+        } else {
+            tracked = false;
+        }
+    }
+    prog.push_back(ret(SECCOMP_RET_ALLOW));
+
+    if (prog.size() > BPF_MAXINSNS) {
+        throw std::invalid_argument("Too many syscalls for seccomp filter");
+    }
+}
+
+void sysfail::SeccompFilter::install() const {
+    if (tracked && covered_text == text_start && (traps & ~covered).none()) {
+        return;
+    }
+
+    sock_fprog fprog{
+        .len = static_cast<unsigned short>(prog.size()),
+        .filter = const_cast<sock_filter*>(prog.data())};
+
+    auto ret = syscall(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0, 0, SYS_prctl);
+    if (ret == 0) {
+        ret = syscall(
+            SECCOMP_SET_MODE_FILTER,
+            0,
+            reinterpret_cast<uint64_t>(&fprog),
+            0,
+            0,
+            0,
+            SYS_seccomp);
+    }
+    if (ret < 0) {
+        auto errStr = std::string(std::strerror(-ret));
+        throw std::runtime_error("Failed to install seccomp filter: " + errStr);
+    }
+    if (covered_text != text_start) {
+        covered.reset();
+        covered_text = text_start;
+    }
+    covered |= traps;
+}
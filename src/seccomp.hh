@@ -0,0 +1,59 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SECCOMP_HH
+#define _SECCOMP_HH
+
+#include <bitset>
+#include <vector>
+#include <cstdint>
+#include <linux/filter.h>
+
+#include "sysfail.hh"
+#include "map.hh"
+
+namespace sysfail {
+    // SIGSYS si_code values (asm-generic/siginfo.h), libc doesn't expose these
+    const int SIGSYS_SECCOMP = 1;
+    const int SIGSYS_USER_DISPATCH = 2;
+
+    // Syscalls numbered below this are tracked per thread to reuse filters
+    const size_t seccomp_tracked_calls = 512;
+
+    class SeccompFilter {
+        std::vector<sock_filter> prog;
+        // Syscalls the filter traps, false if some of them aren't tracked
+        std::bitset<seccomp_tracked_calls> traps;
+        bool tracked;
+        uintptr_t text_start;
+
+    public:
+        // Filter that traps the given syscalls unless they are made by sysfail
+        // itself (from within self_text)
+        SeccompFilter(
+            const std::vector<Syscall>& calls,
+            const AddrRange& self_text);
+
+        // Install the filter on the calling thread. Filters can't be removed
+        // and each one installed slows every syscall the thread makes, so
+        // this is a no-op if filters the thread already has (from this or
+        // earlier sessions) trap all the syscalls this one does. Syscalls
+        // they trap beyond that are passed through by the handler.
+        void install() const;
+    };
+}
+
+#endif
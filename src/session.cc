@@ -16,15 +16,20 @@
 
 #include <iostream>
 #include <sys/prctl.h>
+#include <linux/sched.h>
 #include <ucontext.h>
 #include <cassert>
 #include <cstring>
 #include <cerrno>
 #include <csignal>
-#include <random>
 #include <thread>
+#include <mutex>
+#include <memory>
+#include <pthread.h>
 #include <functional>
 #include <linux/unistd.h>
+#include <cstddef>
+#include <cmath>
 
 #include "sysfail.hh"
 #include "session.hh"
@@ -33,6 +38,8 @@
 #include "log.hh"
 #include "signal.hh"
 #include "helpers.hh"
+#include "epoch.hh"
+#include "delay.hh"
 
 extern "C" {
     extern void sysfail_restore(greg_t*);
@@ -41,17 +48,118 @@ extern "C" {
 using namespace std::placeholders;
 using namespace std::chrono_literals;
 
-void sysfail::continue_syscall(ucontext_t *ctx) {
+namespace {
+    // State of the calling thread if it is enrolled. Syscalls can reach
+    // sysfail on threads that aren't enrolled, eg. seccomp filters can't be
+    // uninstalled and rewritten syscall sites are shared by all threads. Such
+    // syscalls are passed through unless this is set.
+    [[gnu::tls_model("initial-exec")]]
+    thread_local sysfail::ThdState* enrolled_thd = nullptr;
+
+    // Whether the calling thread believes it has SIGSYS blocked. A trap with
+    // SIGSYS blocked kills the process, so while a thread is enrolled
+    // (paused / suspended or not) sysfail blocks it in name only (refer
+    // mask_signals). Derived from the real mask as the thread is armed, the
+    // only time its selector goes to BLOCK.
+    [[gnu::tls_model("initial-exec")]]
+    thread_local bool sigsys_masked = false;
+
+    const uint64_t sigsys_bit = 1UL << (SIGSYS - 1);
+
+    // Timer slack the calling thread had before it was enrolled, 0 unless
+    // the plan sets one (refer Delays)
+    [[gnu::tls_model("initial-exec")]]
+    thread_local uint64_t saved_timer_slack = 0;
+}
+
+extern "C" {
+    // Where sysfail_vfork_stub resumes the thread (refer clone.S)
+    [[gnu::visibility("hidden"), gnu::tls_model("initial-exec")]]
+    thread_local uint64_t sysfail_vfork_resume = 0;
+}
+
+// A clone's child that shares the address space can't return through the
+// SIGSYS handler, the handler's stack is the parent's too. With a stack of
+// its own the child starts on it straight from sysfail_clone, returning to
+// the syscall site pushed on top of it (below which goes a word telling the
+// child whether to enroll itself, refer sysfail_clone_child). Without one
+// (eg. vfork) the thread is sent to make the syscall itself, from
+// sysfail_vfork_stub.
+static bool continue_clone(greg_t* regs) {
+    auto call = regs[REG_RAX];
+    auto site = regs[REG_RIP];
+
+    uint64_t flags = CLONE_VM | CLONE_VFORK;
+    uint64_t* top = nullptr;
+    clone_args* args = nullptr;
+    if (call == SYS_clone) {
+        flags = regs[REG_RDI];
+        top = reinterpret_cast<uint64_t*>(regs[REG_RSI]);
+    } else if (call == SYS_clone3) {
+        args = reinterpret_cast<clone_args*>(regs[REG_RDI]);
+        if (regs[REG_RSI] < CLONE_ARGS_SIZE_VER0) {
+            regs[REG_RAX] = -EINVAL;
+            return true;
+        }
+        flags = args->flags;
+        if (args->stack) {
+            top = reinterpret_cast<uint64_t*>(args->stack + args->stack_size);
+        }
+    }
+
+    if (top == nullptr) {
+        if (flags & CLONE_VM) {
+            sysfail_vfork_resume = site;
+            regs[REG_RIP] = reinterpret_cast<greg_t>(sysfail_vfork_stub);
+            return false;
+        }
+        // like fork, the child gets a copy of the handler's stack
+        regs[REG_RAX] = sysfail::syscall(
+            regs[REG_RDI], regs[REG_RSI], regs[REG_RDX],
+            regs[REG_R10], regs[REG_R8], regs[REG_R9], call);
+        return true;
+    }
+
+    top[-1] = site;
+    top[-2] = (flags & CLONE_THREAD) && enrolled_thd != nullptr &&
+            enrolled_thd->inject.load(std::memory_order_relaxed)
+        ? sysfail::CLONE_CHILD_ENROLL |
+            (sigsys_masked ? sysfail::CLONE_CHILD_SIGSYS_MASKED : 0)
+        : 0;
+    const auto pushed = 2 * sizeof(uint64_t);
+    greg_t r[NGREG];
+    std::memcpy(r, regs, sizeof(r));
+    if (args) {
+        args->stack_size -= pushed;
+    } else {
+        r[REG_RSI] -= pushed;
+    }
+    regs[REG_RAX] = sysfail_clone(r);
+    if (args) {
+        args->stack_size += pushed;
+    }
+    return true;
+}
+
+bool sysfail::continue_syscall(greg_t* regs) {
+    switch (regs[REG_RAX]) {
+        case SYS_clone:
+        case SYS_clone3:
+        case SYS_vfork:
+            return continue_clone(regs);
+    }
+
     auto rax = syscall(
-        ctx->uc_mcontext.gregs[REG_RDI],
-        ctx->uc_mcontext.gregs[REG_RSI],
-        ctx->uc_mcontext.gregs[REG_RDX],
-        ctx->uc_mcontext.gregs[REG_R10],
-        ctx->uc_mcontext.gregs[REG_R8],
-        ctx->uc_mcontext.gregs[REG_R9],
-        ctx->uc_mcontext.gregs[REG_RAX]);
+        regs[REG_RDI],
+        regs[REG_RSI],
+        regs[REG_RDX],
+        regs[REG_R10],
+        regs[REG_R8],
+        regs[REG_R9],
+        regs[REG_RAX]);
 
-    ctx->uc_mcontext.gregs[REG_RAX] = rax;
+    regs[REG_RAX] = rax;
+    return true;
 }
 
 sysfail::ActiveOutcome::ActiveOutcome(
@@ -59,27 +167,213 @@ sysfail::ActiveOutcome::ActiveOutcome(
 ) : fail(_o.fail),
     delay(_o.delay),
     max_delay(_o.max_delay),
-    eligibility_check(_o.eligible) {
-    double cumulative = 0;
-    for (const auto& [err_no, weight] : _o.error_weights) {
-        cumulative += weight;
-        error_by_cumulative_p[cumulative] = err_no;
+    errors(_o.error_weights),
+    latency(_o.latency, _o.max_delay),
+    fail_at(threshold(_o.fail.p)),
+    fail_after_at(threshold(_o.fail.after_bias)),
+    delay_at(threshold(_o.delay.p)),
+    delay_after_at(threshold(_o.delay.after_bias)),
+    args(_o.args),
+    eligibility_check(_o.eligible) {}
+
+sysfail::ErrorTable::ErrorTable(const std::map<Errno, double>& weights) {
+    double total = 0;
+    for (const auto& [err_no, weight] : weights) {
+        if (! std::isfinite(weight) || weight < 0) {
+            throw std::invalid_argument(
+                "Invalid weight for error " + std::to_string(err_no));
+        }
+        total += weight;
+    }
+    if (weights.empty()) return;
+    if (total <= 0) {
+        throw std::invalid_argument("Error weights must not all be 0");
+    }
+
+    auto n = weights.size();
+    std::vector<double> scaled;
+    std::vector<Errno> errs;
+    for (const auto& [err_no, weight] : weights) {
+        scaled.push_back(weight * n / total);
+        errs.push_back(err_no);
+    }
+
+    std::vector<size_t> small, large;
+    for (size_t i = 0; i < n; i++) {
+        (scaled[i] < 1 ? small : large).push_back(i);
+    }
+
+    columns.resize(n);
+    while (! small.empty() && ! large.empty()) {
+        auto s = small.back(), l = large.back();
+        small.pop_back();
+        columns[s] = {threshold(scaled[s]), errs[s], errs[l]};
+        scaled[l] -= 1 - scaled[s];
+        if (scaled[l] < 1) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // Left-overs are 1 up to rounding error
+    for (auto i : large) columns[i] = {threshold(1), errs[i], errs[i]};
+    for (auto i : small) columns[i] = {threshold(1), errs[i], errs[i]};
+}
+
+namespace {
+    void check(bool ok, const char* what) {
+        if (! ok) throw std::invalid_argument(what);
+    }
+
+    // Finite and at least 0
+    bool non_negative(double v) {
+        return std::isfinite(v) && v >= 0;
+    }
+}
+
+sysfail::LatencySampler::Mode sysfail::LatencySampler::mode(
+    const latency::Mode& m,
+    std::chrono::microseconds max
+) {
+    auto ns = [](latency::us d) {
+        return std::chrono::duration<double, std::nano>(d).count();
+    };
+    return std::visit([&](const auto& d) -> Mode {
+        using D = std::decay_t<decltype(d)>;
+        if constexpr (std::is_same_v<D, latency::UpToMax>) {
+            return {Kind::Uniform, 0, ns(max)};
+        } else if constexpr (std::is_same_v<D, latency::Constant>) {
+            check(non_negative(d.value.count()), "Constant latency must be >= 0");
+            return {Kind::Constant, ns(d.value), 0};
+        } else if constexpr (std::is_same_v<D, latency::Uniform>) {
+            check(
+                non_negative(d.lo.count()) && std::isfinite(d.hi.count()) &&
+                    d.lo <= d.hi,
+                "Uniform latency needs 0 <= lo <= hi");
+            return {Kind::Uniform, ns(d.lo), ns(d.hi - d.lo)};
+        } else if constexpr (std::is_same_v<D, latency::Exponential>) {
+            check(
+                non_negative(d.mean.count()),
+                "Exponential latency needs mean >= 0");
+            return {Kind::Exponential, ns(d.mean), 0};
+        } else if constexpr (std::is_same_v<D, latency::Normal>) {
+            check(
+                std::isfinite(d.mean.count()) && non_negative(d.stddev.count()),
+                "Normal latency needs stddev >= 0");
+            return {Kind::Normal, ns(d.mean), ns(d.stddev)};
+        } else if constexpr (std::is_same_v<D, latency::LogNormal>) {
+            check(
+                non_negative(d.median.count()) && d.median.count() > 0 &&
+                    non_negative(d.sigma),
+                "LogNormal latency needs median > 0 and sigma >= 0");
+            return {Kind::LogNormal, ns(d.median), d.sigma};
+        } else {
+            check(
+                non_negative(d.scale.count()) && d.scale.count() > 0 &&
+                    non_negative(d.shape) && d.shape > 0,
+                "Pareto latency needs scale > 0 and shape > 0");
+            return {Kind::Pareto, ns(d.scale), 1 / d.shape};
+        }
+    }, m);
+}
+
+sysfail::LatencySampler::LatencySampler(
+    const latency::Distribution& d,
+    std::chrono::microseconds max
+) : slow_at(0),
+    max_ns(std::min(
+        std::chrono::duration<double, std::nano>(
+            max.count() > 0 ? max : latency::uncapped_max).count(),
+        max_sample_ns)) {
+    if (auto b = std::get_if<latency::Bimodal>(&d)) {
+        check(b->p >= 0 && b->p <= 1, "Bimodal latency needs p in [0, 1]");
+        fast = mode(b->fast, max);
+        slow = mode(b->slow, max);
+        slow_at = threshold(b->p);
+        return;
     }
+    fast = slow = std::visit([&](const auto& m) -> Mode {
+        if constexpr (std::is_same_v<std::decay_t<decltype(m)>, latency::Bimodal>) {
+            return {};
+        } else {
+            return mode(m, max);
+        }
+    }, d);
 }
 
 bool sysfail::ActiveOutcome::eligible(const greg_t* regs) const {
+    if (!args(regs)) return false;
+
     if (!eligibility_check) return true;
 
      // user wants to filter individual syscalls
     return eligibility_check(regs);
 }
 
-sysfail::ActivePlan::ActivePlan(const Plan& p) : p(p) {
+sysfail::ActivePlan::ActivePlan(
+    const Plan& p,
+    Decide decide
+) : p(p), static_decide(decide), planned{}, by_call{} {
+    if (std::holds_alternative<syscall_dispatch::Seccomp>(p.dispatch)) {
+        // Clones would have to be trapped, but libc blocks SIGSYS for real
+        // around them in this mode (refer syscall_dispatch::Seccomp)
+        using thread_discovery::OnClone;
+        if (std::holds_alternative<OnClone>(p.thd_disc)) {
+            throw std::invalid_argument(
+                "OnClone thread discovery doesn't work with seccomp dispatch");
+        }
+    }
+}
+
+void sysfail::ActivePlan::add_call(Syscall call) {
+    if (call < 0 || call >= MAX_SYSCALL) {
+        throw std::invalid_argument(
+            "Syscall " + std::to_string(call) + " is out of range");
+    }
+    planned[call >> 6] |= 1UL << (call & 63);
+    // never failure-injected, see handle_sigsys
+    if (std::holds_alternative<syscall_dispatch::Seccomp>(p.dispatch) &&
+        call != SYS_rt_sigprocmask &&
+        call != SYS_rt_sigreturn &&
+        call != SYS_exit) {
+        trapped.push_back(call);
+    }
+}
+
+sysfail::ActivePlan::ActivePlan(const Plan& p) : ActivePlan(p, nullptr) {
+    outcomes.reserve(p.outcomes.size()); // by_call points into it
     for (const auto& [call, o] : p.outcomes) {
-        outcomes.insert({call, o});
+        add_call(call);
+        try {
+            outcomes.emplace_back(o);
+        } catch (const std::invalid_argument& e) {
+            throw std::invalid_argument(
+                "Outcome for syscall " + std::to_string(call) + " (" +
+                std::string(syscalls::name(call)) + "): " + e.what());
+        }
+        by_call[call] = &outcomes.back();
     }
 }
 
+sysfail::ActivePlan::ActivePlan(
+    const Plan& p,
+    std::span<const Syscall> calls,
+    Decide decide
+) : ActivePlan(p, decide) {
+    for (auto call : calls) add_call(call);
+}
+
+sysfail::CompiledPlan sysfail::static_plan::compile(
+    const Plan& p,
+    std::span<const Syscall> calls,
+    Decide decide
+) {
+    return CompiledPlan(std::make_shared<const ActivePlan>(p, calls, decide));
+}
+
+sysfail::CompiledPlan sysfail::Plan::compile() const {
+    return CompiledPlan(std::make_shared<const ActivePlan>(*this));
+}
+
 void unmask_sigsys(int signum) {
     struct sigaction sa;
     // Retrieve current signal action
@@ -95,65 +389,194 @@ void unmask_sigsys(int signum) {
 }
 
 
+// Offsets sysfail_handle_sigsys (restore.S) depends on
+static_assert(offsetof(siginfo_t, si_code) == 8);
+static_assert(offsetof(ucontext_t, uc_mcontext.gregs) == 40);
+static_assert(sysfail::MAX_SYSCALL == 512);
+
+[[gnu::visibility("hidden")]]
+alignas(64) uint64_t sysfail::sysfail_slow_path[MAX_SYSCALL / 64] = {};
+
+static void set_slow_path(uint64_t* bits, sysfail::Syscall call) {
+    bits[call >> 6] |= 1UL << (call & 63);
+}
+
+// Publishes the syscalls the session needs the full SIGSYS handler for
+static void publish_slow_path(const sysfail::ActiveSession& s) {
+    uint64_t bits[sysfail::MAX_SYSCALL / 64] = {};
+    if (s.rewriter) {
+        // every trap is a chance to rewrite the site
+        std::fill(std::begin(bits), std::end(bits), ~0UL);
+    } else {
+        std::copy(s.plan.planned.begin(), s.plan.planned.end(), bits);
+        for (auto call : {
+                SYS_rt_sigprocmask,
+                SYS_rt_sigreturn,
+                SYS_clone,
+                SYS_clone3,
+                SYS_fork,
+                SYS_vfork,
+                SYS_exit}) {
+            set_slow_path(bits, call);
+        }
+    }
+    for (size_t i = 0; i < std::size(bits); i++) {
+        __atomic_store_n(&sysfail::sysfail_slow_path[i], bits[i], __ATOMIC_RELEASE);
+    }
+}
+
+static void clear_slow_path() {
+    for (auto& b : sysfail::sysfail_slow_path) {
+        __atomic_store_n(&b, 0, __ATOMIC_RELEASE);
+    }
+}
+
+static uint64_t random_seed() {
+    return (uint64_t(std::random_device{}()) << 32) | std::random_device{}();
+}
+
 sysfail::ActiveSession::ActiveSession(
-    const Plan& _plan,
-    AddrRange&& _self_addr
-) : plan(_plan), self_text(_self_addr) {
+    CompiledPlan _plan
+) : compiled(std::move(_plan)),
+    plan(*compiled),
+    self_text(libsysfail_text()),
+    seed(random_seed()),
+    enrollments(0),
+    paused(false),
+    stopping(false) {
+    delay::calibrate();
+    if (std::holds_alternative<syscall_dispatch::Seccomp>(plan.p.dispatch)) {
+        seccomp = std::make_unique<SeccompFilter>(plan.trapped, self_text);
+    }
+    if (std::holds_alternative<syscall_dispatch::Rewrite>(plan.p.dispatch) &&
+        Rewriter::available()) {
+        // Only rewriting needs the whole address space mapped out
+        auto m = get_mmap(getpid());
+        if (! m) throw std::runtime_error("Couldn't read process' mappings");
+        rewriter = std::make_unique<Rewriter>(std::move(*m));
+    }
+    publish_slow_path(*this);
     for(int i=1;i<NSIG;i++) {
         if(i == SIGKILL or i == SIGSTOP) continue;
         unmask_sigsys(i);
     }
-    enable_handler(SIGSYS, handle_sigsys);
-    enable_handler(SIG_REARM, reenable_sysfail);
+    enable_handler(SIGSYS, sysfail_handle_sigsys);
     enable_handler(SIG_ENABLE, enable_sysfail);
     enable_handler(SIG_DISABLE, disable_sysfail);
 }
 
-void sysfail::ActiveSession::initialize() {
+void sysfail::ActiveSession::initialize(std::span<const pid_t> known) {
     tmon = std::make_unique<sysfail::ThdMon>(
         plan.p.thd_disc,
-        std::bind(&ActiveSession::thd_track, this, _1, _2));
+        std::bind(&ActiveSession::thd_track, this, _1, _2),
+        known);
 }
 
-void sysfail::ActiveSession::thd_track(pid_t tid, sysfail::DiscThdSt state) {
+void sysfail::ActiveSession::thd_track(
+    std::span<const pid_t> tids,
+    sysfail::DiscThdSt state
+) {
     switch (state) {
         case DiscThdSt::Existing:
         case DiscThdSt::Spawned:
-            thd_enable(tid);
+            thd_enable(tids);
             break;
         case DiscThdSt::Terminated:
-            thd_disable(tid);
+            // Threads retire themselves as they exit (refer
+            // retire_exiting_thread), but not if their exit isn't trapped
+            // (seccomp doesn't trap exit) or they are killed
+            thd_forget(tids);
     }
 }
 
-pid_t sysfail::ActiveSession::disarm() {
-    auto tid = gettid();
-    ThdSt::accessor a;
-    if (thd_st.find(a, tid)) {
-        a->second.on = SYSCALL_DISPATCH_FILTER_ALLOW;
+sysfail::ThdSlots::ThdSlots(size_t capacity) :
+    capacity(capacity),
+    slots(std::make_unique<ThdState[]>(capacity)),
+    used(0) {}
+
+sysfail::ThdState* sysfail::ThdSlots::claim(pid_t tid) {
+    if (find(tid)) return nullptr;
+
+    for (size_t i = 0; i < capacity; i++) {
+        pid_t free = 0;
+        if (! slots[i].tid.compare_exchange_strong(free, -tid)) continue;
+
+        auto u = used.load();
+        while (u < i + 1 && ! used.compare_exchange_weak(u, i + 1));
+
+        // Resolve concurrent claims for the same thread: a claim yields to a
+        // lower pending claim or to a committed one, and waits for higher
+        // pending claims to resolve. Exactly one claim wins.
+        for (size_t j = 0; j < used.load(); j++) {
+            if (j == i) continue;
+            auto t = slots[j].tid.load();
+            while (t == -tid && j > i) t = slots[j].tid.load();
+            if (t == tid || (t == -tid && j < i)) {
+                slots[i].tid.store(0);
+                return nullptr;
+            }
+        }
+        slots[i].tid.store(tid);
+        return &slots[i];
     }
-    assert(! a.empty());
-    return tid;
+    log("No free thread slot (capacity %zu), not enrolling %d\n", capacity, tid);
+    return nullptr;
 }
 
-void sysfail::ActiveSession::rearm() {
-    auto tid = gettid();
-    ThdSt::accessor a;
-    if (thd_st.find(a, tid)) {
-        a->second.on = SYSCALL_DISPATCH_FILTER_BLOCK;
+sysfail::ThdState* sysfail::ThdSlots::find(pid_t tid) const {
+    auto u = used.load();
+    for (size_t i = 0; i < u; i++) {
+        if (slots[i].tid.load(std::memory_order_acquire) == tid) {
+            return &slots[i];
+        }
     }
+    return nullptr;
 }
 
-static void enable(
-    const sysfail::AddrRange& self_text,
+void sysfail::ThdSlots::release(ThdState* st) {
+    st->on = SYSCALL_DISPATCH_FILTER_ALLOW;
+    st->inject.store(false);
+    st->suspended.store(false);
+    st->scopes.store(0);
+    st->tid.store(0, std::memory_order_release);
+}
+
+void sysfail::ThdSlots::keep_only(ThdState* keep, pid_t tid) {
+    auto u = used.load();
+    for (size_t i = 0; i < u; i++) {
+        auto& st = slots[i];
+        if (&st == keep) {
+            st.tid.store(tid);
+        } else if (st.tid.load() != 0) {
+            release(&st);
+        }
+        st.done = nullptr;
+        st.sig_coord.try_acquire();
+        st.sig_coord.release();
+    }
+}
+
+std::vector<pid_t> sysfail::ThdSlots::tids() const {
+    std::vector<pid_t> r;
+    auto u = used.load();
+    for (size_t i = 0; i < u; i++) {
+        auto t = slots[i].tid.load(std::memory_order_acquire);
+        if (t > 0) r.push_back(t);
+    }
+    return r;
+}
+
+// Points syscall-user-dispatch of the calling thread at st's selector
+static void arm(
+    const sysfail::ActiveSession& s,
     sysfail::ThdState* st
 ) {
     auto tid = gettid();
     auto ret = prctl(
         PR_SET_SYSCALL_USER_DISPATCH,
         PR_SYS_DISPATCH_ON,
-        self_text.start,
-        self_text.length,
+        s.self_text.start,
+        s.self_text.length,
         &st->on);
     if (ret == -1) {
         auto errStr = std::string(std::strerror(errno));
@@ -161,11 +584,62 @@ static void enable(
             << "Failed to enable sysfail for " << tid << "\n";
         throw std::runtime_error("Failed to enable sysfail: " + errStr);
     }
+}
+
+static long prctl_raw(int op, uint64_t arg) {
+    return sysfail::syscall(op, arg, 0, 0, 0, 0, SYS_prctl);
+}
+
+static void enable(
+    const sysfail::ActiveSession& s,
+    sysfail::ThdState* st
+) {
+    auto slack = s.plan.p.delays.timer_slack.count();
+    if (slack > 0) {
+        saved_timer_slack = prctl_raw(PR_GET_TIMERSLACK, 0);
+        prctl_raw(PR_SET_TIMERSLACK, slack);
+    }
+
+    if (s.seccomp) {
+        s.seccomp->install();
+        enrolled_thd = st;
+        __atomic_store_n(
+            &st->on, SYSCALL_DISPATCH_FILTER_BLOCK, __ATOMIC_SEQ_CST);
+        s.set_inject(*st);
+        return;
+    }
 
-    st->on = SYSCALL_DISPATCH_FILTER_BLOCK;
+    // Take over blocking SIGSYS before arming the thread
+    uint64_t old = 0;
+    sysfail::syscall(
+        SIG_UNBLOCK,
+        reinterpret_cast<uint64_t>(&sigsys_bit),
+        reinterpret_cast<uint64_t>(&old),
+        sizeof(old),
+        0,
+        0,
+        SYS_rt_sigprocmask);
+    sigsys_masked = old & sigsys_bit;
+
+    arm(s, st);
+    enrolled_thd = st;
+    __atomic_store_n(&st->on, SYSCALL_DISPATCH_FILTER_BLOCK, __ATOMIC_SEQ_CST);
+    s.set_inject(*st);
 }
 
-static void disable() {
+// With `ctx` the thread is disabled from a signal handler, whose return
+// restores the signal mask from it.
+static void disable(
+    const sysfail::ActiveSession& s,
+    ucontext_t* ctx = nullptr
+) {
+    enrolled_thd = nullptr;
+    if (saved_timer_slack > 0) {
+        prctl_raw(PR_SET_TIMERSLACK, saved_timer_slack);
+        saved_timer_slack = 0;
+    }
+    if (s.seccomp) return;
+
     auto ret = prctl(
         PR_SET_SYSCALL_USER_DISPATCH,
         PR_SYS_DISPATCH_OFF,
@@ -177,44 +651,111 @@ static void disable() {
         std::cerr << "Failed to disable sysfail, err: " << errStr << "\n";
         throw std::runtime_error("Failed to disable sysfail: " + errStr);
     }
+
+    // Block SIGSYS for real now that the thread can't trap anymore
+    if (sigsys_masked) {
+        if (ctx) {
+            sigaddset(&ctx->uc_sigmask, SIGSYS);
+        } else {
+            sysfail::syscall(
+                SIG_BLOCK,
+                reinterpret_cast<uint64_t>(&sigsys_bit),
+                0,
+                sizeof(sigsys_bit),
+                0,
+                0,
+                SYS_rt_sigprocmask);
+        }
+        sigsys_masked = false;
+    }
     // caller must erase the thd-state
 }
 
-void sysfail::ActiveSession::thd_enable(pid_t tid) {
-    if (! plan.p.selector(tid)) return; // TODO: log
+void sysfail::ActiveSession::seed_rng(ThdState& st, pid_t tid) {
+    auto n = enrollments.fetch_add(1, std::memory_order_relaxed);
+    st.rng.seed(seed ^ (uint64_t(tid) << 32) ^ n);
+}
 
-    ThdSt::accessor a;
-    if (! thd_st.insert(a, tid)) return; // idempotency check
+// Sends sig to every thread in sts, then waits for all of their handlers.
+// The caller holds, and releases, sig_coord of each.
+static void signal_all(
+    const std::vector<sysfail::ThdState*>& sts,
+    int sig
+) {
+    std::latch done(sts.size());
+    for (auto st : sts) {
+        st->done = &done;
+        sysfail::send_signal<sysfail::ThdState>(
+            st->tid.load(std::memory_order_relaxed),
+            sig,
+            st,
+            [](auto* st) { st->done->count_down(); });
+    }
+    done.wait();
+    for (auto st : sts) {
+        st->done = nullptr;
+    }
+}
 
-    auto& st = a->second;
-    st.sig_coord.acquire();
+void sysfail::ActiveSession::thd_enable(pid_t tid) {
+    thd_enable(std::span(&tid, 1));
+}
+
+void sysfail::ActiveSession::thd_enable(std::span<const pid_t> tids) {
+    std::vector<ThdState*> sts;
+    sts.reserve(tids.size());
+    for (auto tid : tids) {
+        if (! plan.p.selector(tid)) continue; // TODO: log
 
-    send_signal<ThdState>(
-        tid,
-        SIG_ENABLE,
-        &st,
-        [](auto* st) { st->sig_coord.release(); });
+        auto st = thd_st.claim(tid);
+        if (st == nullptr) continue; // idempotency check
 
-    st.sig_coord.acquire();
-    st.sig_coord.release(); // leave sem in a re-usable state
+        seed_rng(*st, tid);
+        st->sig_coord.acquire();
+        sts.push_back(st);
+    }
+    signal_all(sts, SIG_ENABLE);
+    for (auto st : sts) {
+        st->sig_coord.release();
+    }
 }
 
 void sysfail::ActiveSession::thd_disable(pid_t tid) {
-    sysfail::ThdSt::accessor a;
-    if (! thd_st.find(a, tid)) return; // idempotency check
+    thd_disable(std::span(&tid, 1));
+}
+
+void sysfail::ActiveSession::thd_disable(std::span<const pid_t> tids) {
+    std::vector<ThdState*> sts;
+    sts.reserve(tids.size());
+    for (auto tid : tids) {
+        auto st = thd_st.find(tid);
+        if (st == nullptr) continue; // idempotency check
 
-    auto& st = a->second;
-    st.sig_coord.acquire();
+        st->sig_coord.acquire();
+        // Someone else removed the thread while we waited
+        if (st->tid.load() != tid) {
+            st->sig_coord.release();
+            continue;
+        }
+        sts.push_back(st);
+    }
+    signal_all(sts, SIG_DISABLE);
+    // Slot first, so that whoever gets sig_coord next sees it released
+    for (auto st : sts) {
+        thd_st.release(st);
+        st->sig_coord.release();
+    }
+}
 
-    send_signal<ThdState>(
-        tid,
-        SIG_DISABLE,
-        &st,
-        [](auto* st) { st->sig_coord.release(); });
+void sysfail::ActiveSession::thd_forget(std::span<const pid_t> tids) {
+    for (auto tid : tids) {
+        auto st = thd_st.find(tid);
+        if (st == nullptr) continue; // retired itself, or removed
 
-    st.sig_coord.acquire();
-    st.sig_coord.release(); // leave sem in a re-usable state
-    thd_st.erase(a);
+        st->sig_coord.acquire();
+        if (st->tid.load() == tid) thd_st.release(st);
+        st->sig_coord.release();
+    }
 }
 
 void sysfail::ActiveSession::thd_enable() {
@@ -224,84 +765,107 @@ void sysfail::ActiveSession::thd_enable() {
         return;
     }
 
-    ThdSt::accessor a;
-    if (thd_st.insert(a, tid)) {
-        a->second.on = SYSCALL_DISPATCH_FILTER_ALLOW;
-        enable(self_text, &a->second);
+    auto st = thd_st.claim(tid);
+    if (st) {
+        seed_rng(*st, tid);
+        enable(*this, st);
     }
 }
 
 void sysfail::ActiveSession::thd_disable() {
+    auto st = thd_st.find(gettid());
+    if (st == nullptr) return; // idempotency check
+
+    st->on = SYSCALL_DISPATCH_FILTER_ALLOW;
+    disable(*this);
+    thd_st.release(st);
+}
+
+void sysfail::ActiveSession::after_fork() {
+    auto self = enrolled_thd;
     auto tid = gettid();
-    ThdSt::accessor a;
-    if (! thd_st.find(a, tid)) return; // idempotency check
+    thd_st.keep_only(self, tid);
+
+    // Or the child would fail / delay syscalls in lock-step with the parent
+    seed = random_seed();
+    enrollments.store(0);
+    if (self) seed_rng(*self, tid);
+
+    // The forking thread keeps its enrollment as it was in the parent
+    tmon->abandon();
+    (void) tmon.release();
+    initialize(std::span(&tid, 1));
 
-    a->second.on = SYSCALL_DISPATCH_FILTER_ALLOW;
-    disable();
-    thd_st.erase(a);
+    // The kernel doesn't carry syscall-user-dispatch over to the child (a
+    // seccomp filter it does). Last, so that the setup above isn't trapped.
+    if (self && ! seccomp) arm(*this, self);
 }
 
-namespace {
-    void sleep(std::chrono::microseconds dur) {
-        // TODO: avoid libc's nanosleep, if someone failure-injects it
-        // this will confuse them. Use an equivalent
-        // continue-sleep-after-interrupt helper instead.
-        std::this_thread::sleep_for(dur);
+void sysfail::ActiveSession::set_inject(ThdState& st) const {
+    auto wanted = [&] {
+        return ! (paused.load() ||
+            (st.suspended.load() && st.scopes.load() == 0));
+    };
+    // Flags are re-read after the store, so whoever stores last stores what
+    // the latest flags call for.
+    for (;;) {
+        bool want = wanted();
+        st.inject.store(want);
+        if (wanted() == want) return;
     }
 }
 
-void sysfail::ActiveSession::fail_maybe(ucontext_t *ctx) {
-    auto regs = ctx->uc_mcontext.gregs;
-    auto call = ctx->uc_mcontext.gregs[REG_RAX];
+void sysfail::ActiveSession::pause() {
+    paused.store(true);
+    thd_st.each([this](ThdState& st) { set_inject(st); });
+}
 
-    auto o = plan.outcomes.find(call);
-    if (o == plan.outcomes.end() || !o->second.eligible(regs)) {
-        continue_syscall(ctx);
-        return;
+void sysfail::ActiveSession::resume() {
+    paused.store(false);
+    thd_st.each([this](ThdState& st) { set_inject(st); });
+}
+
+void sysfail::ActiveSession::suspend(pid_t tid) {
+    auto st = thd_st.find(tid);
+    if (st == nullptr) return;
+    st->suspended.store(true);
+    set_inject(*st);
+}
+
+void sysfail::ActiveSession::unsuspend(pid_t tid) {
+    auto st = thd_st.find(tid);
+    if (st == nullptr) return;
+    st->suspended.store(false);
+    set_inject(*st);
+}
+
+sysfail::Injection sysfail::ActiveSession::fail_maybe(greg_t* regs) {
+    Injection inj;
+    if (enrolled_thd != nullptr &&
+        enrolled_thd->inject.load(std::memory_order_relaxed)) {
+        plan.decide(regs, enrolled_thd->rng, inj);
+        inj.spin = plan.p.delays.spin;
     }
+    return inj;
+}
 
-    thread_local std::mt19937 rnd_eng(rd());
-
-    std::uniform_real_distribution<double> p_dist(0, 1);
-    auto delay_after = std::chrono::microseconds(0);
-    if (o->second.delay.p > 0) {
-        if (p_dist(rnd_eng) < o->second.delay.p) {
-            auto after_p = p_dist(rnd_eng);
-            auto bias = o->second.delay.after_bias;
-            std::uniform_int_distribution<int> delay_dist(0, o->second.max_delay.count());
-            auto delay = std::chrono::microseconds(delay_dist(rnd_eng));
-            if (bias && after_p < bias) {
-                delay_after = delay;
-            } else {
-                sleep(delay);
-            }
-        }
+void sysfail::Injection::apply(greg_t* regs) const {
+    if (delay.count()) {
+        delay::sleep(delay, spin);
     }
-    Errno fail_with = 0;
-    if (o->second.fail.p > 0) {
-        if (p_dist(rnd_eng) < o->second.fail.p) {
-            auto err_p = p_dist(rnd_eng);
-            auto e = o->second.error_by_cumulative_p.lower_bound(err_p);
-            auto after_p = p_dist(rnd_eng);
-            if (o->second.fail.after_bias && (after_p < o->second.fail.after_bias)) {
-                fail_with = e->second;
-            } else {
-                if (e != o->second.error_by_cumulative_p.end()) {
-                    // kernel returns negative 0 - 4096 error codes in %rax
-                    regs[REG_RAX] = -e->second;
-                    return;
-                }
-            }
-        }
+    if (fail) {
+        // kernel returns negative 0 - 4096 error codes in %rax
+        regs[REG_RAX] = -fail;
+        return;
     }
 
-    continue_syscall(ctx);
+    if (!continue_syscall(regs)) return;
 
     if (delay_after.count()) {
-        sleep(delay_after);
+        delay::sleep(delay_after, spin);
     }
-    if (fail_with) {
-        regs[REG_RAX] = -fail_with;
+    if (fail_after) {
+        regs[REG_RAX] = -fail_after;
     }
 }
 
@@ -314,8 +878,31 @@ void sysfail::ActiveSession::discover_threads() {
     tmon->rescan_threads();
 }
 
+sysfail::thread_discovery::Stats
+sysfail::ActiveSession::discovery_stats() const {
+    if (!tmon) {
+        throw std::runtime_error("Thread monitor not initialized");
+    }
+    return tmon->stats();
+}
+
 namespace {
-    std::shared_ptr<sysfail::ActiveSession> session = nullptr;
+    // Owner of the active session, used by the Session API (under Session::lck)
+    std::unique_ptr<sysfail::ActiveSession> active;
+
+    // The active session as seen by signal handlers and the rewrite
+    // dispatcher. Only dereferenced inside a read-side section of `readers`,
+    // ~Session unpublishes it and waits for a grace period before freeing.
+    std::atomic<sysfail::ActiveSession*> session = nullptr;
+    sysfail::Epoch readers;
+
+    // Held from the prepare to the parent / child fork handlers, and by
+    // Session construction and teardown, so a fork sees a session either
+    // whole or not at all
+    std::mutex fork_mtx;
+    // Session::lck of the live session, held (exclusively) across forks so
+    // that no Session call is half-way when the child is re-armed
+    std::shared_mutex* live_lck = nullptr;
 
     struct NotifySigHdlrCompletion {
         sysfail::ThdState* st;
@@ -325,21 +912,22 @@ namespace {
         ): st(reinterpret_cast<sysfail::ThdState*>(info->si_value.sival_ptr)) {}
 
         ~NotifySigHdlrCompletion() {
-            st->sig_coord.release();
+            st->done->count_down();
         }
     };
 }
 
 static void sysfail::enable_sysfail(int sig, siginfo_t *info, void *ucontext) {
     {
+        Epoch::Reader rd(readers);
         NotifySigHdlrCompletion r(info); // Expect thread-state is initialized
-        auto s = session;
+        auto s = session.load();
         if (!s) {
             std::cerr << "Can't enable sysfail, no active session\n";
             return;
         }
 
-        enable(s->self_text, r.st);
+        enable(*s, r.st);
     }
 
     ucontext_t *ctx = (ucontext_t *)ucontext;
@@ -347,114 +935,396 @@ static void sysfail::enable_sysfail(int sig, siginfo_t *info, void *ucontext) {
 }
 
 static void sysfail::disable_sysfail(int sig, siginfo_t *info, void *ucontext) {
+    Epoch::Reader rd(readers);
     NotifySigHdlrCompletion r(info); // Expect thread-state is initialized
-    auto s = session;
+    auto s = session.load();
     if (!s) {
         std::cerr << "Can't disable sysfail, no active session\n";
         return;
     }
 
-    disable();
+    disable(*s, static_cast<ucontext_t*>(ucontext));
 }
 
-static void sysfail::reenable_sysfail(int sig, siginfo_t *info, void *ucontext) {
-    ucontext_t *ctx = (ucontext_t *)ucontext;
+// Syscalls that must not be issued from a rewritten site. They either don't
+// return to the caller (rt_sigreturn) or start executing a new thread or
+// process on the caller's stack (clone, vfork), which can't be done from the
+// rewrite dispatcher's frame.
+static bool rewritable(greg_t call) {
+    return call != SYS_rt_sigreturn &&
+        call != SYS_clone &&
+        call != SYS_clone3 &&
+        call != SYS_vfork;
+}
+
+// LIBC blocks all signals around thread spawn and teardown, but a trap with
+// SIGSYS blocked kills the process. So an armed thread only blocks SIGSYS in
+// name: it is dropped from the set on the way to the kernel and reported
+// in the old set on the way back. The thread stays armed throughout (pause
+// and suspend don't disarm it either), and nothing needs to be done once it
+// unblocks SIGSYS again.
+static void mask_signals(greg_t* regs) {
+    auto how = regs[REG_RDI];
+    auto set = reinterpret_cast<const uint64_t*>(regs[REG_RSI]);
+    auto old = reinterpret_cast<uint64_t*>(regs[REG_RDX]);
+
+    if (regs[REG_R10] != sizeof(uint64_t)) {
+        // rejected by the kernel
+        sysfail::continue_syscall(regs);
+        return;
+    }
+
+    auto masked = sigsys_masked;
+    uint64_t want = 0;
+    if (set) {
+        want = *set;
+        if (how == SIG_BLOCK) {
+            masked = masked || (want & sigsys_bit);
+        } else if (how == SIG_UNBLOCK) {
+            masked = masked && !(want & sigsys_bit);
+        } else if (how == SIG_SETMASK) {
+            masked = want & sigsys_bit;
+        }
+        want &= ~sigsys_bit;
+    }
+
+    auto ret = sysfail::syscall(
+        how,
+        set ? reinterpret_cast<uint64_t>(&want) : 0,
+        reinterpret_cast<uint64_t>(old),
+        sizeof(uint64_t),
+        0,
+        0,
+        SYS_rt_sigprocmask);
+    if (ret == 0) {
+        if (old && sigsys_masked) *old |= sigsys_bit;
+        sigsys_masked = masked;
+    }
+    regs[REG_RAX] = ret;
+}
+
+// Disables the calling thread and frees its slot as it makes SYS_exit, so
+// that the slot can be reused right away and nobody has to signal a thread
+// that's gone. libc has blocked all signals by now, so a SIG_DISABLE sent by
+// someone removing the thread concurrently would never be handled. It is
+// taken off the queue and completed here instead.
+static void retire_exiting_thread(sysfail::ActiveSession& s) {
+    auto st = enrolled_thd;
+    pid_t tid = sysfail::syscall(0, 0, 0, 0, 0, 0, SYS_gettid);
+
+    const uint64_t sigs = (1UL << (sysfail::SIG_DISABLE - 1)) |
+        (1UL << (sysfail::SIG_ENABLE - 1));
+    while (! st->sig_coord.try_acquire()) {
+        siginfo_t info;
+        timespec wait{0, 100000};
+        auto sig = sysfail::syscall(
+            reinterpret_cast<uint64_t>(&sigs),
+            reinterpret_cast<uint64_t>(&info),
+            reinterpret_cast<uint64_t>(&wait),
+            sizeof(sigs),
+            0,
+            0,
+            SYS_rt_sigtimedwait);
+        if (sig > 0 && info.si_code == SI_QUEUE) {
+            auto pending = static_cast<sysfail::ThdState*>(
+                info.si_value.sival_ptr);
+            if (pending->done) pending->done->count_down();
+        }
+    }
+
+    __atomic_store_n(&st->on, SYSCALL_DISPATCH_FILTER_ALLOW, __ATOMIC_RELAXED);
+    disable(s);
+    // Unless whoever held sig_coord removed the thread already
+    if (st->tid.load() == tid) {
+        s.thd_st.release(st);
+    }
+    st->sig_coord.release();
+}
+
+// Handles a syscall that was diverted to sysfail, either by a SIGSYS or by a
+// rewritten syscall site. It is passed through unless `trapped` (the calling
+// thread is enrolled and armed). With `patch_site` the site is rewritten so
+// that its next syscall skips the signal.
+//
+// The session is only used to decide what to do, the syscall is made after
+// leaving the read-side section because it may block for arbitrarily long
+// (or not return at all, eg. exit).
+static void handle_syscall(greg_t* regs, bool trapped, bool patch_site) {
+    auto syscall = regs[REG_RAX];
+
+    sysfail::Injection inj;
     {
-        auto s = session;
-        if (s) { s->rearm(); }
+        sysfail::Epoch::Reader rd(readers);
+        auto s = session.load();
+
+        if (s && patch_site && s->rewriter && rewritable(syscall)) {
+            s->rewriter->patch(regs[REG_RIP] - 2);
+        }
+
+        if (s && trapped && syscall == SYS_exit) {
+            retire_exiting_thread(*s);
+        } else if (s && trapped && syscall != SYS_rt_sigprocmask) {
+            inj = s->fail_maybe(regs);
+        }
+    }
+
+    if (trapped && syscall == SYS_rt_sigprocmask) {
+        mask_signals(regs);
+    } else {
+        inj.apply(regs);
     }
-    sysfail_restore(ctx->uc_mcontext.gregs);
 }
 
 static void sysfail::handle_sigsys(int sig, siginfo_t *info, void *ucontext) {
     ucontext_t *ctx = (ucontext_t *)ucontext;
 
-    {
-        auto s = session;
-        auto syscall = ctx->uc_mcontext.gregs[REG_RAX];
-
-        // log("Handling syscall: %d\n", syscall);
-
-        // LIBC turns off all signals before thread spawn and teardown.
-        // Keep sysfail disabled here because libc wants quiescent state in
-        // these parts.
-        if (s && syscall == SYS_rt_sigprocmask) {
-            auto sigset = (sigset_t*)ctx->uc_mcontext.gregs[REG_RSI];
-            auto sigsys_on = sigismember(sigset, SIGSYS);
-            if (sigsys_on) {
-                auto cmd = ctx->uc_mcontext.gregs[REG_RDI];
-                if (cmd == SIG_BLOCK || cmd == SIG_SETMASK) {
-                    auto tid = s->disarm();
-                    continue_syscall(ctx);
-                    send_signal<void>(tid, SIG_REARM, nullptr);
-                }
-            }
-        } else if (syscall == SYS_rt_sigreturn) {
-             auto rax = set_rsp_and_exec_syscall(
-                     ctx->uc_mcontext.gregs[REG_RDI],
-                     ctx->uc_mcontext.gregs[REG_RSI],
-                     ctx->uc_mcontext.gregs[REG_RDX],
-                     ctx->uc_mcontext.gregs[REG_R10],
-                     ctx->uc_mcontext.gregs[REG_R8],
-                     ctx->uc_mcontext.gregs[REG_R9],
-                     ctx->uc_mcontext.gregs[REG_RAX],
-                     ctx->uc_mcontext.gregs[REG_RSP]);
-        } else if (s && syscall != SYS_exit) {
-            s->fail_maybe(ctx);
-        } else {
-            continue_syscall(ctx);
-        }
+    // Not a trapped syscall (eg. SIGSYS sent with kill), nothing to do
+    if (info->si_code != SIGSYS_USER_DISPATCH &&
+        info->si_code != SIGSYS_SECCOMP) {
+        sysfail_restore(ctx->uc_mcontext.gregs);
+    }
+
+    auto regs = ctx->uc_mcontext.gregs;
+    auto syscall = regs[REG_RAX];
+
+    // log("Handling syscall: %d\n", syscall);
+
+    if (syscall == SYS_rt_sigreturn) {
+         auto rax = set_rsp_and_exec_syscall(
+                 regs[REG_RDI],
+                 regs[REG_RSI],
+                 regs[REG_RDX],
+                 regs[REG_R10],
+                 regs[REG_R8],
+                 regs[REG_R9],
+                 regs[REG_RAX],
+                 regs[REG_RSP]);
     }
+
+    // Seccomp traps planned syscalls for as long as the thread lives,
+    // regardless of whether the thread is still enrolled.
+    auto trapped = info->si_code != SIGSYS_SECCOMP ||
+        (enrolled_thd != nullptr &&
+            __atomic_load_n(&enrolled_thd->on, __ATOMIC_RELAXED) ==
+                SYSCALL_DISPATCH_FILTER_BLOCK);
+
+    handle_syscall(regs, trapped, trapped);
+
     sysfail_restore(ctx->uc_mcontext.gregs);
     assert(false);
 }
 
-sysfail::Session::Session(const Plan& _plan) {
-    auto m = get_mmap(getpid());
-    assert(m.has_value());
+// Called by sysfail_handle_sigsys (restore.S) for syscalls that need more
+// than a pass-through
+extern "C" [[gnu::visibility("hidden")]] void sysfail_handle_sigsys_slow(
+    int sig,
+    siginfo_t *info,
+    void *ucontext
+) {
+    sysfail::handle_sigsys(sig, info, ucontext);
+}
+
+// Called by sysfail_rewrite_entry (see rewrite.S) for syscalls made from
+// rewritten sites. Returns non-zero to have the entry stub re-execute the
+// (restored) syscall instruction at the site instead.
+extern "C" int sysfail_rewrite_dispatch(greg_t* regs) {
+    auto call = regs[REG_RAX];
 
-    auto s = std::make_shared<ActiveSession>(_plan, m->self_text());
-    session = s;
-    s->initialize();
+    if (!rewritable(call)) {
+        sysfail::Epoch::Reader rd(readers);
+        auto s = session.load();
+        if (s && s->rewriter) s->rewriter->demote(regs[REG_RIP] - 2);
+        return 1;
+    }
+
+    auto trapped = enrolled_thd != nullptr &&
+        __atomic_load_n(&enrolled_thd->on, __ATOMIC_RELAXED) ==
+            SYSCALL_DISPATCH_FILTER_BLOCK;
+    handle_syscall(regs, trapped, false);
+    return 0;
+}
+
+// Called by sysfail_clone (clone.S) on the child of a clone made on behalf
+// of an enrolled thread, before the child returns to the syscall site. With
+// OnClone discovery the child enrolls itself here, so none of its own code
+// runs un-injected.
+extern "C" [[gnu::visibility("hidden")]] void sysfail_clone_child(
+    uint64_t word
+) {
+    sysfail::Epoch::Reader rd(readers);
+    auto s = session.load();
+    if (s == nullptr || s->stopping.load() ||
+        ! std::holds_alternative<sysfail::thread_discovery::OnClone>(
+            s->plan.p.thd_disc)) {
+        return;
+    }
+
+    try {
+        s->thd_enable();
+    } catch (const std::exception& e) {
+        sysfail::log(
+            "Failed to enroll spawned thread %d: %s\n", gettid(), e.what());
+        return;
+    }
+    if (enrolled_thd && (word & sysfail::CLONE_CHILD_SIGSYS_MASKED)) {
+        sigsys_masked = true;
+    }
+}
+
+static void prepare_fork() {
+    fork_mtx.lock();
+    if (live_lck) live_lck->lock();
+}
+
+static void parent_after_fork() {
+    if (live_lck) live_lck->unlock();
+    fork_mtx.unlock();
+}
+
+static void child_after_fork() {
+    if (live_lck) {
+        // Re-made rather than unlocked, the lock remembers the forking
+        // thread by its tid in the parent
+        std::construct_at(live_lck);
+        readers.forget_readers();
+        try {
+            active->after_fork();
+        } catch (const std::exception& e) {
+            sysfail::log("Failed to re-arm session after fork: %s\n", e.what());
+        }
+    }
+    fork_mtx.unlock();
+}
+
+sysfail::Session::Session(const Plan& _plan) : Session(_plan.compile()) {}
+
+sysfail::Session::Session(CompiledPlan _plan) {
+    static std::once_flag fork_handlers;
+    std::call_once(fork_handlers, [] {
+        pthread_atfork(prepare_fork, parent_after_fork, child_after_fork);
+    });
+    std::lock_guard<std::mutex> fl(fork_mtx);
+
+    active = std::make_unique<ActiveSession>(std::move(_plan));
+    session.store(active.get());
+    active->initialize();
+    live_lck = &lck;
 }
 
 sysfail::Session::~Session() {
-    auto s = session;
-    if (s) {
+    if (active) {
+        std::lock_guard<std::mutex> fl(fork_mtx);
+        live_lck = nullptr;
         std::unique_lock<std::shared_mutex> l(lck);
-        std::vector<pid_t> tids;
-        for(ThdSt::iterator i = s->thd_st.begin(); i != s->thd_st.end(); ++i) {
-            tids.push_back(i->first);
-        }
-        for (auto tid : tids) {
-            s->thd_disable(tid);
-        }
-        assert(s->thd_st.empty());
-        session.reset();
+        // No more discovery, and let threads that are enrolling themselves
+        // finish, so they are removed below
+        active->tmon.reset();
+        active->stopping.store(true);
+        readers.synchronize();
+        active->thd_disable(active->thd_st.tids());
+        assert(active->thd_st.tids().empty());
+        clear_slow_path();
+        session.store(nullptr);
+        // Handlers that loaded the session before it was unpublished may
+        // still be using it
+        readers.synchronize();
+        active.reset();
     }
 }
 
 void sysfail::Session::add() {
     std::shared_lock<std::shared_mutex> l(lck);
-    session->thd_enable();
+    active->thd_enable();
 }
 
 void sysfail::Session::remove() {
     std::shared_lock<std::shared_mutex> l(lck);
-    session->thd_disable();
+    active->thd_disable();
 }
 
 void sysfail::Session::add(pid_t tid) {
     std::shared_lock<std::shared_mutex> l(lck);
-    session->thd_enable(tid);
+    active->thd_enable(tid);
 }
 
 void sysfail::Session::remove(pid_t tid) {
     std::shared_lock<std::shared_mutex> l(lck);
-    session->thd_disable(tid);
+    active->thd_disable(tid);
+}
+
+void sysfail::Session::add(std::span<const pid_t> tids) {
+    std::shared_lock<std::shared_mutex> l(lck);
+    active->thd_enable(tids);
+}
+
+void sysfail::Session::remove(std::span<const pid_t> tids) {
+    std::shared_lock<std::shared_mutex> l(lck);
+    active->thd_disable(tids);
+}
+
+void sysfail::Session::pause() {
+    std::shared_lock<std::shared_mutex> l(lck);
+    active->pause();
+}
+
+void sysfail::Session::resume() {
+    std::shared_lock<std::shared_mutex> l(lck);
+    active->resume();
+}
+
+void sysfail::Session::suspend(pid_t tid) {
+    std::shared_lock<std::shared_mutex> l(lck);
+    active->suspend(tid);
+}
+
+void sysfail::Session::unsuspend(pid_t tid) {
+    std::shared_lock<std::shared_mutex> l(lck);
+    active->unsuspend(tid);
+}
+
+void sysfail::Session::suspend() {
+    suspend(gettid());
+}
+
+void sysfail::Session::unsuspend() {
+    unsuspend(gettid());
 }
 
 void sysfail::Session::discover_threads() {
     std::shared_lock<std::shared_mutex> l(lck);
-    session->discover_threads();
+    active->discover_threads();
+}
+
+sysfail::thread_discovery::Stats sysfail::Session::discovery_stats() {
+    std::shared_lock<std::shared_mutex> l(lck);
+    return active->discovery_stats();
+}
+
+sysfail::ThdState* sysfail::Scope::enter() {
+    auto st = enrolled_thd;
+    if (st == nullptr) return nullptr;
+
+    Epoch::Reader rd(readers);
+    auto s = session.load();
+    if (s == nullptr) return nullptr;
+
+    if (st->scopes.fetch_add(1) == 0) s->set_inject(*st);
+    return st;
+}
+
+void sysfail::Scope::exit(ThdState* st) {
+    // The thread may have been removed (and its slot reused) since
+    if (st == nullptr || st != enrolled_thd) return;
+
+    Epoch::Reader rd(readers);
+    auto s = session.load();
+    if (s == nullptr || st->scopes.load() == 0) return;
+
+    if (st->scopes.fetch_sub(1) == 1) s->set_inject(*st);
+}
+
+sysfail::Scope::Scope() : st(enter()) {}
+
+sysfail::Scope::~Scope() {
+    exit(st);
 }
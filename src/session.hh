@@ -27,34 +27,162 @@
 #include <csignal>
 #include <random>
 #include <thread>
+#include <array>
+#include <atomic>
+#include <vector>
 #include <linux/unistd.h>
-#include <oneapi/tbb/concurrent_hash_map.h>
-#include <oneapi/tbb/blocked_range.h>
-#include <oneapi/tbb/parallel_for.h>
+#include <semaphore>
+#include <latch>
+#include <span>
+#include <cmath>
 
 #include "sysfail.hh"
 #include "map.hh"
 #include "syscall.hh"
 #include "log.hh"
 #include "thdmon.hh"
+#include "seccomp.hh"
+#include "rewrite.hh"
+#include "sysfail_rng.hh"
+#include "sysfail_static.hh"
+#include "match.hh"
 
 extern "C" {
     extern void sysfail_restore(greg_t*);
+    // SIGSYS handler, passes unplanned syscalls through without entering C++
+    // (refer restore.S)
+    extern void sysfail_handle_sigsys(int sig, siginfo_t *info, void *ucontext);
+    // Clone helpers for syscalls that start a child in the same address
+    // space (refer clone.S)
+    extern long sysfail_clone(greg_t* regs);
+    extern void sysfail_vfork_stub();
 }
 
 namespace sysfail {
-    void continue_syscall(ucontext_t *ctx);
+    // Word the parent leaves below the child's resume address for
+    // sysfail_clone, 0 unless the child should enroll itself
+    const uint64_t CLONE_CHILD_ENROLL = 1;
+    // The parent had SIGSYS blocked (in name, refer mask_signals)
+    const uint64_t CLONE_CHILD_SIGSYS_MASKED = 2;
+
+    // Makes the syscall in regs on the thread's behalf and stores the result
+    // in regs. Returns false if, instead, regs were set up for the thread to
+    // make it once it resumes (refer sysfail_vfork_stub).
+    bool continue_syscall(greg_t* regs);
 
     static void handle_sigsys(int sig, siginfo_t *info, void *ucontext);
-    static void reenable_sysfail(int sig, siginfo_t *info, void *ucontext);
     static void enable_sysfail(int sig, siginfo_t *info, void *ucontext);
     static void disable_sysfail(int sig, siginfo_t *info, void *ucontext);
 
+    // Error mix of an outcome compiled into a Vose alias table, so picking an
+    // error costs one draw and one lookup regardless of the number of errors.
+    // Weights are normalized, so any positive weights work.
+    class ErrorTable {
+        struct Column {
+            // Probability of picking `err` over `alias` in this column
+            Threshold threshold;
+            Errno err;
+            Errno alias;
+        };
+        std::vector<Column> columns;
+
+    public:
+        // Throws std::invalid_argument for negative / non-finite weights, or
+        // if all weights are 0.
+        explicit ErrorTable(const std::map<Errno, double>& weights);
+
+        bool empty() const {
+            return columns.empty();
+        }
+
+        // Picks an error given a uniformly random 64 bit number, the high
+        // part of r * columns picks the column and the low part decides
+        // between err and alias. Must not be empty.
+        Errno pick(uint64_t r) const {
+            auto x = static_cast<unsigned __int128>(r) * columns.size();
+            const auto& c = columns[static_cast<size_t>(x >> 64)];
+            return (static_cast<uint64_t>(x) >> 1) < c.threshold
+                ? c.err
+                : c.alias;
+        }
+    };
+
+    // Delay distribution of an outcome (refer latency::Distribution) with
+    // its parameters checked and converted to nanoseconds, so that sampling
+    // is a few draws and some arithmetic.
+    class LatencySampler {
+        enum class Kind : uint8_t {
+            Constant, Uniform, Exponential, Normal, LogNormal, Pareto
+        };
+        struct Mode {
+            Kind kind;
+            // Constant: a, Uniform: a + b * u, Exponential: -a * ln(u),
+            // Normal: a + b * z, LogNormal: a * exp(b * z),
+            // Pareto: a * u^-b (b = 1 / shape)
+            double a;
+            double b;
+        };
+        Mode fast;
+        Mode slow;
+        // Probability of `slow`, 0 unless bimodal
+        Threshold slow_at;
+        // Samples are capped here (max_delay, or latency::uncapped_max
+        // without one), never beyond max_sample_ns
+        double max_ns;
+        // Largest double below 2^63, converts to int64_t without overflow
+        static constexpr double max_sample_ns = 0x1p63 - 1024;
+
+        // Uniform in (0, 1]
+        static double unit(Rng& rng) {
+            return ((rng.next() >> 11) + 1) * 0x1p-53;
+        }
+
+        // Standard normal (Box-Muller)
+        static double normal(Rng& rng) {
+            return std::sqrt(-2 * std::log(unit(rng))) *
+                std::cos(2 * M_PI * unit(rng));
+        }
+
+        static double draw(const Mode& m, Rng& rng) {
+            switch (m.kind) {
+                case Kind::Constant: return m.a;
+                case Kind::Uniform: return m.a + m.b * unit(rng);
+                case Kind::Exponential: return -m.a * std::log(unit(rng));
+                case Kind::Normal: return m.a + m.b * normal(rng);
+                case Kind::LogNormal: return m.a * std::exp(m.b * normal(rng));
+                case Kind::Pareto: return m.a * std::pow(unit(rng), -m.b);
+            }
+            return 0;
+        }
+
+        static Mode mode(const latency::Mode& m, std::chrono::microseconds max);
+
+    public:
+        // Throws std::invalid_argument for parameters out of range
+        LatencySampler(
+            const latency::Distribution& d,
+            std::chrono::microseconds max);
+
+        std::chrono::nanoseconds sample(Rng& rng) const {
+            const auto& m = (slow_at && rng.chance(slow_at)) ? slow : fast;
+            auto ns = std::min(draw(m, rng), max_ns);
+            return std::chrono::nanoseconds(
+                ns > 0 ? static_cast<int64_t>(ns) : 0);
+        }
+    };
+
     struct ActiveOutcome {
         Probability fail;
         Probability delay;
         std::chrono::microseconds max_delay;
-        std::map<double, Errno> error_by_cumulative_p;
+        ErrorTable errors;
+        LatencySampler latency;
+        // fail / delay probabilities as thresholds for Rng::chance
+        Threshold fail_at;
+        Threshold fail_after_at;
+        Threshold delay_at;
+        Threshold delay_after_at;
+        match::Program args;
         InvocationPredicate eligibility_check;
 
         ActiveOutcome(const Outcome& _o);
@@ -62,44 +190,206 @@ namespace sysfail {
         bool eligible(const greg_t* regs) const;
     };
 
+    // Upper bound (exclusive) on syscall numbers sysfail can plan for. The
+    // largest x86_64 syscall number is well below this.
+    const Syscall MAX_SYSCALL = 512;
+
+    // One bit per syscall, set if a trapped syscall needs the C++ SIGSYS
+    // handler (planned syscalls and the ones handled specially). The rest are
+    // passed through by sysfail_handle_sigsys. Syscalls >= MAX_SYSCALL always
+    // take the slow path.
+    extern "C" uint64_t sysfail_slow_path[MAX_SYSCALL / 64];
+
+    // Plan compiled for sessions (refer Plan::compile), never changes once
+    // built so that any number of sessions can share it.
     struct ActivePlan {
         const Plan p;
-        std::unordered_map<Syscall, const ActiveOutcome> outcomes;
+        // Dense storage for outcomes, in no particular order
+        std::vector<ActiveOutcome> outcomes;
+        // Syscalls a seccomp filter traps for the plan (the planned ones, but
+        // those never failure-injected), empty unless dispatching via seccomp
+        std::vector<Syscall> trapped;
+        // Set for static plans (refer StaticPlan), which decide without the
+        // outcomes
+        const Decide static_decide;
+        // One bit per syscall, set if the syscall has an outcome. This is the
+        // only thing unplanned syscalls (vast majority) ever look at.
+        alignas(64) std::array<uint64_t, MAX_SYSCALL / 64> planned;
+        // Outcome by syscall number, only valid if the planned-bit is set
+        alignas(64) std::array<const ActiveOutcome*, MAX_SYSCALL> by_call;
+
+        // Throws std::invalid_argument for outcomes / strategies the plan
+        // can't have
+        explicit ActivePlan(const Plan& _plan);
+        ActivePlan(
+            const Plan& _plan,
+            std::span<const Syscall> calls,
+            Decide decide);
+
+        // by_call points into outcomes, a copy's would point into this one's.
+        // Sessions share the plan by pointer instead (refer CompiledPlan).
+        ActivePlan(const ActivePlan&) = delete;
+        ActivePlan& operator=(const ActivePlan&) = delete;
+        ActivePlan(ActivePlan&&) = delete;
+        ActivePlan& operator=(ActivePlan&&) = delete;
+
+        // Returns the outcome planned for the syscall or nullptr
+        const ActiveOutcome* outcome(Syscall call) const {
+            auto c = static_cast<uint32_t>(call);
+            if (c >= MAX_SYSCALL) [[unlikely]] return nullptr;
+            if (! (planned[c >> 6] & (1UL << (c & 63)))) [[likely]] {
+                return nullptr;
+            }
+            return by_call[c];
+        }
+
+        // Decides what to inject into the syscall in regs, see Injection
+        void decide(const greg_t* regs, Rng& rng, Injection& inj) const {
+            if (static_decide) {
+                static_decide(regs, rng, inj);
+                return;
+            }
+            auto o = outcome(regs[REG_RAX]);
+            if (o == nullptr || !o->eligible(regs)) return;
+
+            if (rng.chance(o->delay_at)) {
+                auto delay = o->latency.sample(rng);
+                if (rng.chance(o->delay_after_at)) {
+                    inj.delay_after = delay;
+                } else {
+                    inj.delay = delay;
+                }
+            }
+            if (! o->errors.empty() && rng.chance(o->fail_at)) {
+                auto e = o->errors.pick(rng.next());
+                if (rng.chance(o->fail_after_at)) {
+                    inj.fail_after = e;
+                } else {
+                    inj.fail = e;
+                }
+            }
+        }
 
-        ActivePlan(const Plan& _plan);
+    private:
+        // Checks the strategies, the callers add the syscalls
+        ActivePlan(const Plan& _plan, Decide decide);
+
+        // Marks the syscall planned, throws std::invalid_argument if it is
+        // out of range
+        void add_call(Syscall call);
     };
 
-    struct ThdState {
+    // State of an enrolled thread, one cache-line per thread. The thread
+    // reaches its own state through TLS (refer session.cc), everyone else
+    // goes through ThdSlots.
+    struct alignas(64) ThdState {
+        // Owner of the slot, 0 if free, -tid while being claimed
+        std::atomic<pid_t> tid;
+        // Selector byte, read by the kernel on every syscall the thread makes.
+        // BLOCK for as long as the thread is enrolled, paused / suspended
+        // threads keep trapping so that their signal mask stays with sysfail
+        // (refer mask_signals).
         char on;
-        std::binary_semaphore sig_coord; // for signal handler coordination
+        // Whether the thread's trapped syscalls are failure-injected, cleared
+        // while the session is paused or the thread suspended (refer
+        // ActiveSession::set_inject)
+        std::atomic<bool> inject;
+        // Set by Session::suspend, cleared by unsuspend / on release
+        std::atomic<bool> suspended;
+        // Number of live Scopes on the thread, these override suspension.
+        // Changed only by the thread itself.
+        std::atomic<int> scopes;
+        // Held by whoever is enabling / disabling the thread
+        std::binary_semaphore sig_coord;
+        // Counted down by the thread's enable / disable handler
+        std::latch* done;
+        Rng rng; // seeded at enrollment
 
         ThdState() :
+            tid(0),
             on(SYSCALL_DISPATCH_FILTER_ALLOW),
-            sig_coord(1) {}
+            inject(false),
+            suspended(false),
+            scopes(0),
+            sig_coord(1),
+            done(nullptr) {}
     };
 
-    using ThdSt = oneapi::tbb::concurrent_hash_map<pid_t, ThdState>;
+    // Preallocated, lock-free registry of enrolled threads keyed by tid. Used
+    // by the control plane (add / remove / teardown), scans are bounded by
+    // the highest slot ever used.
+    class ThdSlots {
+        const size_t capacity;
+        std::unique_ptr<ThdState[]> slots;
+        // One past the highest slot ever claimed
+        std::atomic<size_t> used;
+
+    public:
+        static const size_t default_capacity = 4096;
+
+        explicit ThdSlots(size_t capacity = default_capacity);
+
+        // Claims a slot for the thread. Returns nullptr if the thread already
+        // has one or if all slots are taken.
+        ThdState* claim(pid_t tid);
+
+        ThdState* find(pid_t tid) const;
+
+        void release(ThdState* st);
+
+        std::vector<pid_t> tids() const;
+
+        // In a forked child, frees every slot but `keep` (the forking
+        // thread's, if it is enrolled), which passes to `tid`. The other
+        // slots belong to threads that didn't make it to the child, which
+        // may have been claiming them or holding their sig_coord.
+        void keep_only(ThdState* keep, pid_t tid);
+
+        // Calls fn with the state of every claimed slot
+        template <typename F> void each(F fn) const {
+            auto u = used.load();
+            for (size_t i = 0; i < u; i++) {
+                if (slots[i].tid.load(std::memory_order_acquire) > 0) {
+                    fn(slots[i]);
+                }
+            }
+        }
+    };
 
     const int SIG_ENABLE = SIGRTMIN + 4;
     const int SIG_DISABLE = SIGRTMIN + 5;
-    const int SIG_REARM = SIGRTMIN + 6;
 
     struct ActiveSession {
-        ActivePlan plan;
+        // Keeps the plan alive, `plan` is what everyone uses
+        const CompiledPlan compiled;
+        const ActivePlan& plan;
         AddrRange self_text;
-        std::random_device rd;
-        ThdSt thd_st;
+        // Per-thread generators are seeded from this and the thread's
+        // enrollment order (reseeded in forked children)
+        uint64_t seed;
+        std::atomic<uint64_t> enrollments;
+        // Set by Session::pause, cleared by resume
+        std::atomic<bool> paused;
+        // Set once the session starts ending, no more threads enroll
+        // themselves (refer sysfail_clone_child) after that.
+        std::atomic<bool> stopping;
+        ThdSlots thd_st;
         std::unique_ptr<ThdMon> tmon;
+        // Set only when dispatching syscalls via seccomp
+        std::unique_ptr<SeccompFilter> seccomp;
+        // Set only when rewriting syscall sites
+        std::unique_ptr<Rewriter> rewriter;
 
-        ActiveSession(const Plan& _plan, AddrRange&& _self_addr);
+        explicit ActiveSession(CompiledPlan _plan);
 
         // Some procedures (sig-handlers etc) require the global-session to be
         // defined, so first define the global session and then initialize it.
-        void initialize();
-
-        pid_t disarm();
+        // Threads in `known` aren't enrolled by thread discovery.
+        void initialize(std::span<const pid_t> known = {});
 
-        void rearm();
+        // Re-arms the session in a forked child, on the forking thread (refer
+        // Session). The plan and the mapping are the parent's, they stay.
+        void after_fork();
 
         // These routines should never be used directly to add or remove
         // threads being sys-failed. Use Session::add() and Session::remove().
@@ -110,13 +400,41 @@ namespace sysfail {
 
         void thd_enable(pid_t tid);
 
+        // Signal all threads first, then wait for all of them at once
+        void thd_enable(std::span<const pid_t> tids);
+
+        void seed_rng(ThdState& st, pid_t tid);
+
         void thd_disable(pid_t tid);
 
-        void fail_maybe(ucontext_t *ctx);
+        void thd_disable(std::span<const pid_t> tids);
+
+        // Frees the slots of threads that are gone, idempotent like
+        // thd_disable. They aren't signalled, a thread reported as exited
+        // may still exist (in the kernel) but never handles signals again.
+        void thd_forget(std::span<const pid_t> tids);
+
+        // Decide what to inject into the syscall in regs, see Injection
+        Injection fail_maybe(greg_t* regs);
+
+        void thd_track(std::span<const pid_t> tids, DiscThdSt state);
 
-        void thd_track(pid_t tid, DiscThdSt state);
+        // Turns injection on for the thread, or off if the session is paused
+        // or the thread suspended (and not in a Scope). Lock-free and
+        // signal-safe, racing callers settle on the latest flags.
+        void set_inject(ThdState& st) const;
+
+        void pause();
+
+        void resume();
+
+        void suspend(pid_t tid);
+
+        void unsuspend(pid_t tid);
 
         void discover_threads();
+
+        thread_discovery::Stats discovery_stats() const;
     };
 
 }
@@ -15,40 +15,121 @@
  */
 
 #include <iostream>
-#include <filesystem>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
 #include <string>
-#include <unordered_set>
 #include <chrono>
+#include <ctime>
 #include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
 
 #include "thdmon.hh"
 #include "helpers.hh"
+#include "syscall.hh"
 
-namespace fs = std::filesystem;
+namespace {
+    // Layout of the entries getdents64 fills the buffer with
+    struct linux_dirent64 {
+        ino64_t d_ino;
+        off64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
+
+    const size_t dents_size = 64 * 1024;
+
+    // Raw syscalls (made from within sysfail), so that the scan is unaffected
+    // by failure injection on the scanning thread
+    long sys(uint64_t a1, uint64_t a2, uint64_t a3, sysfail::Syscall call) {
+        return sysfail::syscall(a1, a2, a3, 0, 0, 0, call);
+    }
+
+    uint64_t thread_cpu_ns() {
+        timespec ts;
+        sys(CLOCK_THREAD_CPUTIME_ID,
+            reinterpret_cast<uint64_t>(&ts), 0, SYS_clock_gettime);
+        return ts.tv_sec * 1'000'000'000UL + ts.tv_nsec;
+    }
+
+    const size_t nl_buf_size = 64 * 1024;
+    const size_t proc_op_len = sizeof(cn_msg) + sizeof(proc_cn_mcast_op);
+    const int proc_ack_timeout_ms = 100;
+
+    // Calls fn with every proc connector event in a batch of netlink messages
+    template <typename F> void each_proc_event(char* buf, long len, F fn) {
+        for (
+            auto h = reinterpret_cast<nlmsghdr*>(buf);
+            NLMSG_OK(h, len);
+            h = NLMSG_NEXT(h, len)
+        ) {
+            if (h->nlmsg_len < NLMSG_LENGTH(sizeof(cn_msg))) continue;
+            auto m = static_cast<const cn_msg*>(NLMSG_DATA(h));
+            if (m->id.idx != CN_IDX_PROC || m->id.val != CN_VAL_PROC) continue;
+            fn(*m, *reinterpret_cast<const proc_event*>(m->data));
+        }
+    }
+}
 
 sysfail::ThdMon::ThdMon(
     const thread_discovery::Strategy& config,
-    ThdEvtHdlr handler
-) : handler(handler) {
-    // Found the hard way that inotify does not work for /proc
-    // so for now we poll!
-    // TODO: replace this with netlink cn_proc based monitoring
-
-    if (! fs::exists(tasks_dir)) {
-        std::string msg("Couldn't find process' task-dir: ");
-        msg += tasks_dir.string();
+    ThdEvtHdlr handler,
+    std::span<const pid_t> known
+) : handler(handler), known_thds(known.begin(), known.end()) {
+    std::sort(known_thds.begin(), known_thds.end());
+
+    // Found the hard way that inotify does not work for /proc, so we poll
+    // unless the kernel's process events are available (refer listen)
+
+    tasks_fd = sys(
+        AT_FDCWD,
+        reinterpret_cast<uint64_t>(tasks_dir.c_str()),
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC,
+        SYS_openat);
+    if (tasks_fd < 0) {
+        std::string msg("Couldn't open process' task-dir: ");
+        msg += tasks_dir.string() + ": " + std::strerror(-tasks_fd);
         throw std::runtime_error(msg);
     }
+    dents.resize(dents_size);
+
+    auto poll = [&](const thread_discovery::ProcPoll& p) {
+        min_itvl = p.itvl;
+        max_itvl = p.max_itvl;
+
+        poller_thd = std::thread(&ThdMon::process, this);
+        poll_initialized.acquire();
+    };
 
     std::visit(cases(
         [&](const thread_discovery::ProcPoll& p) {
-            poll_itvl = p.itvl;
-
-            poller_thd = std::thread(&ThdMon::process, this);
-            poll_initialized.acquire();
+            poll(p);
         },
         [&](const thread_discovery::None& n) {
             scan_tasks();
+        },
+        [&](const thread_discovery::OnClone&) {
+            // Threads spawned from here on are enrolled as they start (refer
+            // sysfail_clone_child), only the ones already running are found
+            // by a scan
+            scan_tasks();
+        },
+        [&](const thread_discovery::ProcConnector& c) {
+            if (subscribe_proc_events()) {
+                poller_thd = std::thread(&ThdMon::listen, this);
+                poll_initialized.acquire();
+            } else {
+                poll(c.fallback);
+            }
         }),
         config);
 }
@@ -60,61 +141,376 @@ sysfail::ThdMon::~ThdMon() {
             stop_ctrl.stop = true;
             stop_ctrl.stop_cv.notify_one();
         }
+        if (stop_fd >= 0) {
+            uint64_t one = 1;
+            sys(stop_fd, reinterpret_cast<uint64_t>(&one), sizeof(one),
+                SYS_write);
+        }
         poller_thd.join();
     }
+    if (nl_fd >= 0) {
+        send_proc_op(PROC_CN_MCAST_IGNORE);
+        sys(nl_fd, 0, 0, SYS_close);
+        sys(stop_fd, 0, 0, SYS_close);
+    }
+    sys(tasks_fd, 0, 0, SYS_close);
+}
+
+void sysfail::ThdMon::abandon() {
+    for (auto fd : {tasks_fd, nl_fd, stop_fd}) {
+        if (fd >= 0) sys(fd, 0, 0, SYS_close);
+    }
+}
+
+void sysfail::ThdMon::know(pid_t tid) {
+    auto it = std::lower_bound(known_thds.begin(), known_thds.end(), tid);
+    if (it == known_thds.end() || *it != tid) known_thds.insert(it, tid);
 }
 
 void sysfail::ThdMon::process() {
     using namespace std::chrono_literals;
 
     pid_t self = gettid();
-    known_thds.insert({self, gen});
-    handler(self, DiscThdSt::Self);
+    know(self);
+    handler(std::span(&self, 1), DiscThdSt::Self);
     bool run = true;
+    auto itvl = min_itvl;
     std::unique_lock<std::mutex> l(stop_ctrl.stop_mtx);
     for (; run; gen++) {
         scan_tasks();
         if (gen == 0) {
             poll_initialized.release();
         }
+        // Back off while the threads are unchanged (only if adaptive)
+        itvl = found.empty() && gone.empty()
+            ? std::min(itvl * 2, max_itvl)
+            : min_itvl;
+        cur_itvl_us.store(itvl.count(), std::memory_order_relaxed);
         stop_ctrl.stop_cv.wait_for(
             l,
-            poll_itvl,
+            itvl,
             [&](){ return stop_ctrl.stop; });
         run = ! stop_ctrl.stop;
     }
+    cur_itvl_us.store(0, std::memory_order_relaxed);
+}
+
+// Reads the tids in the task-dir into `seen`, sorted
+void sysfail::ThdMon::read_tasks() {
+    seen.clear();
+    if (sys(tasks_fd, 0, SEEK_SET, SYS_lseek) < 0) {
+        throw std::runtime_error("Couldn't rewind process' task-dir");
+    }
+    for (;;) {
+        auto n = sys(
+            tasks_fd,
+            reinterpret_cast<uint64_t>(dents.data()),
+            dents.size(),
+            SYS_getdents64);
+        if (n < 0) {
+            throw std::runtime_error(
+                std::string("Couldn't read process' task-dir: ") +
+                std::strerror(-n));
+        }
+        if (n == 0) break;
+
+        for (long off = 0; off < n;) {
+            auto d = reinterpret_cast<linux_dirent64*>(dents.data() + off);
+            off += d->d_reclen;
+
+            auto end = d->d_name + std::strlen(d->d_name);
+            pid_t tid;
+            auto [p, ec] = std::from_chars(d->d_name, end, tid);
+            if (ec == std::errc() && p == end) seen.push_back(tid);
+        }
+    }
+    std::sort(seen.begin(), seen.end());
 }
 
 void sysfail::ThdMon::scan_tasks() {
-    for (const auto& entry : fs::directory_iterator(tasks_dir)) {
-        auto name = entry.path().filename().string();
-        pid_t tid = std::stoi(name);
-        auto it = known_thds.find(tid);
-        if (it == known_thds.end()) {
-            handler( tid, gen == 0 ? DiscThdSt::Existing : DiscThdSt::Spawned);
-            known_thds.insert({tid, gen});
-        } else {
-            it->second = gen;
+    auto cpu_start = thread_cpu_ns();
+
+    read_tasks();
+
+    found.clear();
+    gone.clear();
+    std::set_difference(
+        seen.begin(), seen.end(),
+        known_thds.begin(), known_thds.end(),
+        std::back_inserter(found));
+    std::set_difference(
+        known_thds.begin(), known_thds.end(),
+        seen.begin(), seen.end(),
+        std::back_inserter(gone));
+    std::swap(known_thds, seen);
+
+    auto now = std::chrono::steady_clock::now();
+    if (! found.empty() && gen > 0) {
+        using std::chrono::duration_cast;
+        uint64_t lat = duration_cast<std::chrono::microseconds>(
+            now - last_scan).count();
+        spawned.fetch_add(found.size(), std::memory_order_relaxed);
+        record_latency(lat, lat, 1);
+    }
+    last_scan = now;
+
+    // Stats exclude the handlers, they enroll / remove threads
+    scan_cpu_ns.fetch_add(
+        thread_cpu_ns() - cpu_start, std::memory_order_relaxed);
+    scans.fetch_add(1, std::memory_order_relaxed);
+
+    if (! found.empty()) {
+        handler(found, gen == 0 ? DiscThdSt::Existing : DiscThdSt::Spawned);
+    }
+    if (! gone.empty()) {
+        handler(gone, DiscThdSt::Terminated);
+    }
+}
+
+void sysfail::ThdMon::record_latency(
+    uint64_t sum_us,
+    uint64_t max_us,
+    uint64_t samples
+) {
+    latency_samples.fetch_add(samples, std::memory_order_relaxed);
+    latency_sum_us.fetch_add(sum_us, std::memory_order_relaxed);
+    if (max_us > latency_max_us.load(std::memory_order_relaxed)) {
+        latency_max_us.store(max_us, std::memory_order_relaxed);
+    }
+}
+
+bool sysfail::ThdMon::send_proc_op(int op) {
+    alignas(nlmsghdr) char req[NLMSG_SPACE(proc_op_len)] = {};
+    auto h = reinterpret_cast<nlmsghdr*>(req);
+    h->nlmsg_len = NLMSG_LENGTH(proc_op_len);
+    h->nlmsg_type = NLMSG_DONE;
+    auto m = static_cast<cn_msg*>(NLMSG_DATA(h));
+    m->id.idx = CN_IDX_PROC;
+    m->id.val = CN_VAL_PROC;
+    m->len = sizeof(proc_cn_mcast_op);
+    auto mcast_op = static_cast<proc_cn_mcast_op>(op);
+    std::memcpy(m->data, &mcast_op, sizeof(mcast_op));
+    return sysfail::syscall(
+        nl_fd,
+        reinterpret_cast<uint64_t>(req),
+        h->nlmsg_len,
+        0, 0, 0,
+        SYS_sendto) >= 0;
+}
+
+// Subscribes to the proc connector, false (with nothing left open) if the
+// kernel doesn't have it or doesn't let us (refer ProcConnector)
+bool sysfail::ThdMon::subscribe_proc_events() {
+    nl_fd = sys(
+        PF_NETLINK,
+        SOCK_DGRAM | SOCK_CLOEXEC,
+        NETLINK_CONNECTOR,
+        SYS_socket);
+    if (nl_fd < 0) {
+        nl_fd = -1;
+        return false;
+    }
+
+    bool subscribed = false;
+    sockaddr_nl addr{};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+    if (
+        sys(nl_fd, reinterpret_cast<uint64_t>(&addr), sizeof(addr),
+            SYS_bind) == 0 &&
+        send_proc_op(PROC_CN_MCAST_LISTEN)
+    ) {
+        // The outcome of the request arrives as an ack (the kernel doesn't
+        // echo seq, so it is told apart only by ack), events that precede
+        // it are of no interest (the initial scan finds the threads)
+        nl_buf.resize(nl_buf_size);
+        auto deadline = std::chrono::steady_clock::now() +
+            std::chrono::milliseconds(proc_ack_timeout_ms);
+        bool acked = false;
+        while (! acked) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            pollfd pfd{nl_fd, POLLIN, 0};
+            if (
+                left <= 0 ||
+                sys(reinterpret_cast<uint64_t>(&pfd), 1, left, SYS_poll) <= 0
+            ) break;
+            auto n = sysfail::syscall(
+                nl_fd,
+                reinterpret_cast<uint64_t>(nl_buf.data()),
+                nl_buf.size(),
+                MSG_DONTWAIT, 0, 0,
+                SYS_recvfrom);
+            if (n < 0 && n != -ENOBUFS && n != -EAGAIN) break;
+            each_proc_event(nl_buf.data(), n, [&](auto& m, auto& e) {
+                if (
+                    e.what == proc_event::PROC_EVENT_NONE &&
+                    m.ack == 1
+                ) {
+                    acked = true;
+                    subscribed = e.event_data.ack.err == 0;
+                }
+            });
         }
     }
-    std::vector<pid_t> to_remove;
-    for (auto [tid, g] : known_thds) {
-        if (g < gen) {
-            to_remove.push_back(tid);
+    if (subscribed) {
+        stop_fd = sys(0, EFD_CLOEXEC, 0, SYS_eventfd2);
+        if (stop_fd >= 0) return true;
+        stop_fd = -1;
+        send_proc_op(PROC_CN_MCAST_IGNORE);
+    }
+    sys(nl_fd, 0, 0, SYS_close);
+    nl_fd = -1;
+    return false;
+}
+
+// Discovers threads as the kernel reports them spawned / terminated, the
+// ProcConnector counterpart of process
+void sysfail::ThdMon::listen() {
+    pid_t self = gettid();
+    {
+        std::lock_guard<std::mutex> l(stop_ctrl.stop_mtx);
+        know(self);
+        handler(std::span(&self, 1), DiscThdSt::Self);
+        // Events since subscribing stay queued, the ones about threads
+        // this finds are dropped when applied
+        scan_tasks();
+        gen++;
+    }
+    poll_initialized.release();
+
+    pid_t tgid = getpid();
+    pollfd fds[] = {{nl_fd, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+    for (;;) {
+        auto r = sys(reinterpret_cast<uint64_t>(fds), 2, -1, SYS_poll);
+        if (r == -EINTR) continue;
+        if (r < 0 || fds[1].revents != 0) break;
+        apply_proc_events(tgid);
+    }
+}
+
+// Reports threads of this process spawned / terminated by the queued events
+void sysfail::ThdMon::apply_proc_events(pid_t tgid) {
+    auto cpu_start = thread_cpu_ns();
+
+    found.clear();
+    gone.clear();
+    bool lost = false;
+    uint64_t lat_sum = 0, lat_max = 0, lat_samples = 0;
+    for (;;) {
+        auto n = sysfail::syscall(
+            nl_fd,
+            reinterpret_cast<uint64_t>(nl_buf.data()),
+            nl_buf.size(),
+            MSG_DONTWAIT, 0, 0,
+            SYS_recvfrom);
+        if (n == -ENOBUFS) {
+            lost = true;
+            continue;
         }
+        if (n == -EINTR) continue;
+        if (n <= 0) break;
+
+        uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        each_proc_event(nl_buf.data(), n, [&](auto&, auto& e) {
+            switch (e.what) {
+                case proc_event::PROC_EVENT_FORK:
+                    if (e.event_data.fork.child_tgid == tgid) {
+                        found.push_back(e.event_data.fork.child_pid);
+                        uint64_t lat = now > e.timestamp_ns
+                            ? (now - e.timestamp_ns) / 1000
+                            : 0;
+                        lat_sum += lat;
+                        lat_max = std::max(lat_max, lat);
+                        lat_samples++;
+                    }
+                    break;
+                case proc_event::PROC_EVENT_EXIT:
+                    if (e.event_data.exit.process_tgid == tgid) {
+                        gone.push_back(e.event_data.exit.process_pid);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        });
+    }
+
+    std::lock_guard<std::mutex> l(stop_ctrl.stop_mtx);
+    if (lost) {
+        // The socket overran, a scan puts us back in sync
+        gen++;
+        scan_tasks();
+        return;
+    }
+
+    // Threads that came and went within the batch are not reported, nor
+    // are the ones already known (found by a scan)
+    std::sort(found.begin(), found.end());
+    std::sort(gone.begin(), gone.end());
+    seen.clear();
+    std::set_difference(
+        found.begin(), found.end(),
+        gone.begin(), gone.end(),
+        std::back_inserter(seen));
+    found.clear();
+    std::set_difference(
+        seen.begin(), seen.end(),
+        known_thds.begin(), known_thds.end(),
+        std::back_inserter(found));
+    seen.clear();
+    std::set_intersection(
+        gone.begin(), gone.end(),
+        known_thds.begin(), known_thds.end(),
+        std::back_inserter(seen));
+    std::swap(gone, seen);
+
+    seen.clear();
+    std::set_union(
+        known_thds.begin(), known_thds.end(),
+        found.begin(), found.end(),
+        std::back_inserter(seen));
+    known_thds.clear();
+    std::set_difference(
+        seen.begin(), seen.end(),
+        gone.begin(), gone.end(),
+        std::back_inserter(known_thds));
+
+    spawned.fetch_add(found.size(), std::memory_order_relaxed);
+    if (lat_samples > 0) record_latency(lat_sum, lat_max, lat_samples);
+    scan_cpu_ns.fetch_add(
+        thread_cpu_ns() - cpu_start, std::memory_order_relaxed);
+
+    if (! found.empty()) {
+        handler(found, DiscThdSt::Spawned);
     }
-    for (auto tid : to_remove) {
-        handler(tid, DiscThdSt::Terminated);
-        known_thds.erase(tid);
+    if (! gone.empty()) {
+        handler(gone, DiscThdSt::Terminated);
     }
 }
 
 void sysfail::ThdMon::rescan_threads() {
+    std::lock_guard<std::mutex> l(stop_ctrl.stop_mtx);
     if (poller_thd.joinable()) {
-        std::lock_guard<std::mutex> l(stop_ctrl.stop_mtx);
         gen++;
-        scan_tasks();
-    } else {
-        scan_tasks();
     }
+    scan_tasks();
+}
+
+sysfail::thread_discovery::Stats sysfail::ThdMon::stats() const {
+    using namespace std::chrono;
+
+    thread_discovery::Stats s;
+    s.polls = scans.load(std::memory_order_relaxed);
+    s.poll_cpu = nanoseconds(scan_cpu_ns.load(std::memory_order_relaxed));
+    s.spawned = spawned.load(std::memory_order_relaxed);
+    s.max_latency = microseconds(
+        latency_max_us.load(std::memory_order_relaxed));
+    if (auto n = latency_samples.load(std::memory_order_relaxed)) {
+        s.mean_latency = microseconds(
+            latency_sum_us.load(std::memory_order_relaxed) / n);
+    }
+    s.itvl = microseconds(cur_itvl_us.load(std::memory_order_relaxed));
+    return s;
 }
\ No newline at end of file
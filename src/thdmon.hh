@@ -22,6 +22,9 @@
 #include <thread>
 #include <condition_variable>
 #include <semaphore>
+#include <atomic>
+#include <span>
+#include <vector>
 
 #include "signal.hh"
 #include "sysfail.hh"
@@ -34,11 +37,13 @@ namespace sysfail {
         Terminated
     };
 
-    using ThdEvtHdlr = std::function<void(pid_t, DiscThdSt)>;
+    // Called with all threads found in the same state by a scan
+    using ThdEvtHdlr = std::function<void(std::span<const pid_t>, DiscThdSt)>;
 
     class ThdMon {
         const ThdEvtHdlr handler;
-        std::chrono::microseconds poll_itvl;
+        std::chrono::microseconds min_itvl;
+        std::chrono::microseconds max_itvl;
         std::thread poller_thd;
         std::binary_semaphore poll_initialized{0};
 
@@ -50,17 +55,64 @@ namespace sysfail {
 
         using gen_t = uint32_t;
         gen_t gen = 0;
-        std::unordered_map<pid_t, gen_t> known_thds;
 
+        // Scans reuse these, nothing is allocated once they have grown to
+        // the process' thread count
+        int tasks_fd;
+        std::vector<char> dents;
+        // Sorted tids of threads found by the last scan (and self)
+        std::vector<pid_t> known_thds;
+        std::vector<pid_t> seen, found, gone;
+
+        // Proc-connector subscription (refer ProcConnector), -1 if polling
+        int nl_fd = -1;
+        // Wakes the listener up to stop
+        int stop_fd = -1;
+        std::vector<char> nl_buf;
+
+        // Discovery stats, read by other threads (refer stats())
+        std::chrono::steady_clock::time_point last_scan;
+        std::atomic<uint64_t> scans{0};
+        std::atomic<uint64_t> scan_cpu_ns{0};
+        std::atomic<uint64_t> spawned{0};
+        std::atomic<uint64_t> latency_samples{0};
+        std::atomic<uint64_t> latency_sum_us{0};
+        std::atomic<uint64_t> latency_max_us{0};
+        std::atomic<uint64_t> cur_itvl_us{0};
+
+        void know(pid_t tid);
         void process();
+        void read_tasks();
         void scan_tasks();
 
+        void record_latency(
+            uint64_t sum_us,
+            uint64_t max_us,
+            uint64_t samples);
+
+        bool subscribe_proc_events();
+        bool send_proc_op(int op);
+        void listen();
+        void apply_proc_events(pid_t tgid);
+
     public:
-        ThdMon( const thread_discovery::Strategy& config, ThdEvtHdlr handler);
+        // Threads in `known` are taken as already reported (not Existing)
+        ThdMon(
+            const thread_discovery::Strategy& config,
+            ThdEvtHdlr handler,
+            std::span<const pid_t> known = {});
 
         ~ThdMon();
 
+        // In a forked child, closes the descriptors of a monitor inherited
+        // from the parent. Its poller didn't make it to the child, and may
+        // have held the monitor's mutex / condition-variable at fork, so the
+        // monitor must be leaked rather than destroyed.
+        void abandon();
+
         void rescan_threads();
+
+        thread_discovery::Stats stats() const;
     };
 }
 
@@ -84,7 +84,8 @@ namespace cwrapper {
         sysfail_thread_discovery_strategy_t tdisc_strategy,
         sysfail_thread_discovery_t tdisc_config,
         void* ctx,
-        sysfail_thread_predicate_t selector
+        sysfail_thread_predicate_t selector,
+        sysfail_dispatch_t dispatch = sysfail_dispatch_sud
     ) {
         std::random_device rd;
         thread_local std::mt19937 rnd_eng(rd());
@@ -124,6 +125,7 @@ namespace cwrapper {
         plan->syscall_outcomes = outcomes;
         plan->ctx = ctx;
         plan->selector = selector;
+        plan->dispatch = dispatch;
 
         return plan;
     }
@@ -727,9 +729,164 @@ namespace cwrapper {
                                  << " after: " << delay_after_avg.count();
     }
 
+    TEST(CWrapper, TestLatencyDistribution) {
+        auto outcome = mk_outcome(
+            SYS_getppid,
+            {0, 0},
+            {1, 0},
+            0,
+            nullptr,
+            nullptr,
+            {});
+        outcome->outcome.latency = {
+            .mode = {sysfail_latency_constant, 100, 0},
+            .p_alt = 0.25,
+            .alt = {sysfail_latency_uniform, 2000, 3000}};
+        auto plan = mk_plan(outcome, sysfail_tdisc_none, {}, nullptr, nullptr);
+
+        std::unique_ptr<sysfail_session_t, void(*)(sysfail_session_t*)> s(
+            sysfail_start(plan.get()),
+            [](sysfail_session_t* s) { s->stop(s); });
+
+        auto slow = 0;
+        for (int i = 0; i < 200; i++) {
+            auto start = std::chrono::steady_clock::now();
+            ::syscall(SYS_getppid);
+            auto took = std::chrono::steady_clock::now() - start;
+            ASSERT_GE(took, 100us);
+            slow += took >= 2ms;
+        }
+        EXPECT_NEAR(slow, 50, 25);
+    }
+
+    TEST(CWrapper, TestSeccompDispatch) {
+        Pipe<int> p;
+
+        // seccomp filters outlive the session, keep it off the test thread
+        std::thread t([&]() {
+            auto plan = mk_plan(
+                mk_outcome(
+                    SYS_write,
+                    {1, 0},
+                    {0, 0},
+                    0,
+                    nullptr,
+                    nullptr,
+                    {{EIO, 1}}),
+                sysfail_tdisc_none,
+                {},
+                nullptr,
+                nullptr,
+                sysfail_dispatch_seccomp);
+
+            auto s = sysfail_start(plan.get());
+            s->add_this_thread(s);
+
+            auto wr = write_n(p, 10, 0);
+            EXPECT_EQ(wr.successful_writes.size(), 0);
+            EXPECT_EQ(wr.errs[EIO], 10);
+
+            s->remove_this_thread(s);
+
+            wr = write_n(p, 10, 10);
+            EXPECT_EQ(wr.successful_writes.size(), 10);
+
+            s->stop(s);
+
+            auto rr = read_n(p, 10);
+            EXPECT_EQ(err_count(rr.errs), 0);
+            EXPECT_EQ(rr.nos.size(), 10);
+        });
+        t.join();
+    }
+
+    TEST(CWrapper, TestScopedInjection) {
+        Pipe<int> p;
+
+        auto plan = mk_plan(
+            mk_outcome(
+                SYS_write,
+                {1, 0},
+                {0, 0},
+                0,
+                nullptr,
+                nullptr,
+                {{EIO, 1}}),
+            sysfail_tdisc_none,
+            {},
+            nullptr,
+            nullptr,
+            sysfail_dispatch_sud);
+
+        auto s = sysfail_start(plan.get());
+        s->suspend_this_thread(s);
+
+        auto wr = write_n(p, 10, 0);
+        EXPECT_EQ(wr.successful_writes.size(), 10);
+
+        auto outer = s->enter_scope(s);
+        auto inner = s->enter_scope(s);
+        wr = write_n(p, 10, 10);
+        EXPECT_EQ(wr.errs[EIO], 10);
+        s->exit_scope(s, inner);
+        wr = write_n(p, 10, 10);
+        EXPECT_EQ(wr.errs[EIO], 10);
+        s->exit_scope(s, outer);
+
+        wr = write_n(p, 10, 10);
+        EXPECT_EQ(wr.successful_writes.size(), 10);
+
+        s->unsuspend_this_thread(s);
+        wr = write_n(p, 10, 20);
+        EXPECT_EQ(wr.errs[EIO], 10);
+
+        s->stop(s);
+
+        auto rr = read_n(p, 20);
+        EXPECT_EQ(err_count(rr.errs), 0);
+        EXPECT_EQ(rr.nos.size(), 20);
+    }
+
+    TEST(CWrapper, TestCompiledPlan) {
+        Pipe<int> p;
+
+        auto plan = mk_plan(
+            mk_outcome(
+                SYS_write,
+                {1, 0},
+                {0, 0},
+                0,
+                nullptr,
+                nullptr,
+                {{EIO, 1}}),
+            sysfail_tdisc_none,
+            {},
+            nullptr,
+            nullptr);
+
+        auto c = sysfail_plan_compile(plan.get());
+        ASSERT_TRUE(c);
+        plan.reset();
+
+        for (int i = 0; i < 3; i++) {
+            auto s = sysfail_start_compiled(c);
+            auto wr = write_n(p, 10, 0);
+            EXPECT_EQ(wr.errs[EIO], 10);
+            if (i == 2) sysfail_compiled_plan_free(c);
+            s->stop(s);
+        }
+
+        auto wr = write_n(p, 10, 0);
+        EXPECT_EQ(wr.successful_writes.size(), 10);
+        auto rr = read_n(p, 10);
+        EXPECT_EQ(rr.nos.size(), 10);
+    }
+
     TEST(CWrapper, TestNullPlan) {
         auto s = sysfail_start(nullptr);
         EXPECT_FALSE(s);
+        EXPECT_FALSE(sysfail_plan_compile(nullptr));
+        EXPECT_FALSE(sysfail_start_compiled(nullptr));
     }
 
     TEST(CWrapper, UnderstandsSyscallArgs) {
@@ -0,0 +1,100 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+
+#include "delay.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    namespace {
+        using Clock = std::chrono::steady_clock;
+
+        std::chrono::nanoseconds median_delay(
+            std::chrono::nanoseconds dur,
+            std::chrono::nanoseconds spin
+        ) {
+            std::vector<std::chrono::nanoseconds> took;
+            for (int i = 0; i < 201; i++) {
+                auto start = Clock::now();
+                delay::sleep(dur, spin);
+                took.push_back(Clock::now() - start);
+            }
+            std::nth_element(took.begin(), took.begin() + 100, took.end());
+            return took[100];
+        }
+    }
+
+    TEST(Delay, LandsWithinAFewPercentOfShortDelays) {
+        delay::calibrate();
+        if (delay::tsc_hz() == 0) GTEST_SKIP() << "No invariant TSC";
+        EXPECT_GT(delay::tsc_hz(), 100'000'000);
+
+        for (auto d : {5us, 10us, 20us, 50us}) {
+            auto m = median_delay(d, 100us);
+            // Reading the clock around the delay takes tens of ns
+            EXPECT_GE(m, d * 0.97) << "delay " << d.count() << "us";
+            EXPECT_LE(m, d * 1.03 + 100ns) << "delay " << d.count() << "us";
+        }
+    }
+
+    TEST(Delay, SleepsThenSpins) {
+        delay::calibrate();
+
+        // Mostly slept, the spin makes up for timer slack
+        auto m = median_delay(500us, 100us);
+        EXPECT_GE(m, 500us);
+        EXPECT_LE(m, 500us * 1.05);
+    }
+
+    TEST(Delay, ResumesAfterInterruptions) {
+        delay::calibrate();
+
+        struct sigaction sa, old;
+        std::memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = [](int) {};
+        ASSERT_EQ(sigaction(SIGUSR1, &sa, &old), 0);
+
+        std::atomic<bool> done = false;
+        auto self = pthread_self();
+        std::thread t([&] {
+            while (! done.load()) {
+                pthread_kill(self, SIGUSR1);
+                std::this_thread::sleep_for(1ms);
+            }
+        });
+
+        auto start = Clock::now();
+        delay::sleep(30ms, 100us);
+        auto took = Clock::now() - start;
+        done.store(true);
+        t.join();
+        sigaction(SIGUSR1, &old, nullptr);
+
+        EXPECT_GE(took, 30ms);
+        EXPECT_LT(took, 40ms);
+    }
+}
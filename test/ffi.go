@@ -47,6 +47,7 @@ func mk_sysfail_session(
 	outcome.outcome.fail = p(1.0)
 	outcome.outcome.delay = p(0.0)
 	outcome.outcome.max_delay_usec = 0
+	outcome.outcome.latency = C.sysfail_latency_t{}
 	outcome.outcome.ctx = nil
 	outcome.outcome.eligible = nil
 	outcome.outcome.num_errors = 1
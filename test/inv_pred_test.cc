@@ -137,4 +137,55 @@ namespace sysfail {
             })(regs),
             ret);
     }
-}
\ No newline at end of file
+
+    TEST(InvPred, GeneratesTypedPredicates) {
+        char buf[8];
+        gregset_t regs;
+        std::memset(regs, 0, sizeof(regs));
+        regs[REG_RAX] = SYS_pwrite64;
+        regs[REG_RDI] = 7;
+        regs[REG_RSI] = reinterpret_cast<greg_t>(buf);
+        regs[REG_RDX] = sizeof(buf);
+        regs[REG_R10] = -1;
+
+        auto pred = on<SYS_pwrite64>(
+            [&](int fd, const void* b, size_t n, off_t off) {
+                EXPECT_EQ(b, buf);
+                EXPECT_EQ(n, sizeof(buf));
+                EXPECT_EQ(off, -1);
+                return fd == 7;
+            });
+        EXPECT_TRUE(pred(regs));
+        regs[REG_RDI] = 8;
+        EXPECT_FALSE(pred(regs));
+
+        // mmap's addr is declared as an integer, but can be taken as pointer
+        regs[REG_RDI] = 0;
+        EXPECT_TRUE(on<SYS_mmap>(
+            [](void* addr, size_t, int, int, int, off_t) {
+                return addr == nullptr;
+            })(regs));
+
+        EXPECT_TRUE(on<SYS_getpid>([]() { return true; })(regs));
+    }
+
+    TEST(InvPred, DescribesSyscalls) {
+        static_assert(syscalls::info(SYS_read)->arity() == 3);
+        static_assert(syscalls::info(SYS_mmap)->arity() == 6);
+        static_assert(syscalls::info(SYS_getpid)->arity() == 0);
+        static_assert(
+            syscalls::info(SYS_openat)->arg(1) == syscalls::ArgKind::Ptr);
+        static_assert(syscalls::number("clone3") == SYS_clone3);
+        static_assert(syscalls::info(1000) == nullptr);
+
+        for (const auto& i : syscalls::table) {
+            EXPECT_EQ(syscalls::info(i.nr), &i);
+            EXPECT_EQ(syscalls::number(i.name), i.nr);
+            EXPECT_LE(i.arity(), 6) << i.name;
+        }
+        EXPECT_EQ(syscalls::name(SYS_pwrite64), "pwrite64");
+        EXPECT_EQ(syscalls::name(SYS_exit_group), "exit_group");
+        EXPECT_EQ(syscalls::name(1000), "");
+        EXPECT_FALSE(syscalls::number("no_such_syscall").has_value());
+    }
+}
@@ -17,6 +17,9 @@
 #include <gtest/gtest.h>
 #include <optional>
 #include <variant>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "map.hh"
 
@@ -64,4 +67,57 @@ namespace sysfail {
 
 		ASSERT_TRUE(mappings.path.find("libsysfail.so") != std::string::npos);
 	}
+
+	TEST(Map, FindsSelfTextWithoutParsingMaps) {
+		auto m = get_mmap(getpid());
+		ASSERT_TRUE(m.has_value());
+		auto expected = m->self_text();
+
+		auto text = libsysfail_text();
+		EXPECT_EQ(text.start, expected.start);
+		EXPECT_EQ(text.length, expected.length);
+		EXPECT_EQ(text.permissions, expected.permissions);
+		EXPECT_TRUE(text.libsysfail()) << text.path;
+	}
+
+	TEST(Map, ParsesEveryMapping) {
+		auto pg = sysconf(_SC_PAGESIZE);
+		auto p = static_cast<char*>(mmap(
+			nullptr, 3 * pg, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		ASSERT_NE(p, MAP_FAILED);
+		// splits it in 3
+		ASSERT_EQ(mprotect(p + pg, pg, PROT_READ | PROT_WRITE), 0);
+
+		auto m = get_mmap(getpid());
+		ASSERT_TRUE(m.has_value());
+		EXPECT_TRUE(std::is_sorted(
+			m->ranges.begin(),
+			m->ranges.end(),
+			[](auto& a, auto& b) { return a.start < b.start; }));
+
+		auto mid = m->find(reinterpret_cast<uintptr_t>(p + pg + 10));
+		ASSERT_NE(mid, nullptr);
+		EXPECT_EQ(mid->start, reinterpret_cast<uintptr_t>(p + pg));
+		EXPECT_EQ(mid->length, pg);
+		EXPECT_EQ(mid->permissions, "rw-p");
+		EXPECT_EQ(mid->path, "");
+		EXPECT_EQ(mid->inode, 0);
+
+		auto last = m->find(reinterpret_cast<uintptr_t>(p + 2 * pg));
+		ASSERT_NE(last, nullptr);
+		EXPECT_EQ(last->permissions, "r--p");
+
+		auto vdso = std::find_if(
+			m->ranges.begin(),
+			m->ranges.end(),
+			[](auto& r) { return r.path == "[vdso]"; });
+		ASSERT_NE(vdso, m->ranges.end());
+		EXPECT_TRUE(vdso->vdso());
+		EXPECT_TRUE(vdso->executable());
+
+		auto text = m->self_text();
+		EXPECT_NE(text.inode, 0);
+
+		munmap(p, 3 * pg);
+	}
 }
\ No newline at end of file
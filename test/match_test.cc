@@ -0,0 +1,128 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <ucontext.h>
+#include <cstring>
+#include <fcntl.h>
+
+#include "match.hh"
+
+using namespace testing;
+
+namespace sysfail {
+    using namespace match;
+
+    namespace {
+        struct Regs {
+            gregset_t regs;
+
+            Regs(
+                invp::A a1,
+                invp::A a2 = 0,
+                invp::A a3 = 0,
+                invp::A a4 = 0,
+                invp::A a5 = 0,
+                invp::A a6 = 0
+            ) {
+                std::memset(regs, 0, sizeof(regs));
+                regs[REG_RDI] = a1;
+                regs[REG_RSI] = a2;
+                regs[REG_RDX] = a3;
+                regs[REG_R10] = a4;
+                regs[REG_R8] = a5;
+                regs[REG_R9] = a6;
+            }
+        };
+
+        bool eval(const Rule& r, const Regs& regs) {
+            return Program(r)(regs.regs);
+        }
+    }
+
+    TEST(Match, EvaluatesArgumentConditions) {
+        EXPECT_TRUE(eval(arg(1) == 7, {7}));
+        EXPECT_FALSE(eval(arg(1) == 7, {8}));
+        EXPECT_TRUE(eval(arg(1) != 7, {8}));
+        EXPECT_FALSE(eval(arg(1) != 7, {7}));
+
+        EXPECT_TRUE(eval(arg(2).in({9, 10}), {0, 10}));
+        EXPECT_FALSE(eval(arg(2).in({9, 10}), {0, 11}));
+        EXPECT_FALSE(eval(arg(2).in({}), {0, 0}));
+
+        EXPECT_TRUE(eval(arg(3).between(-100, 100), {0, 0, -100}));
+        EXPECT_TRUE(eval(arg(3).between(-100, 100), {0, 0, 100}));
+        EXPECT_FALSE(eval(arg(3).between(-100, 100), {0, 0, 101}));
+        EXPECT_FALSE(eval(arg(3).between(-100, 100), {0, 0, -101}));
+
+        EXPECT_TRUE(eval(arg(4).any_of(O_DIRECT | O_SYNC), {0, 0, 0, O_DIRECT}));
+        EXPECT_FALSE(eval(arg(4).any_of(O_DIRECT), {0, 0, 0, O_RDWR}));
+        EXPECT_TRUE(eval(arg(5).all_of(0b101), {0, 0, 0, 0, 0b111}));
+        EXPECT_FALSE(eval(arg(5).all_of(0b101), {0, 0, 0, 0, 0b110}));
+
+        EXPECT_TRUE(eval(arg(6) == -1, {0, 0, 0, 0, 0, -1}));
+
+        // matches everything
+        EXPECT_TRUE(eval(Rule(), {42}));
+    }
+
+    TEST(Match, CombinesConditions) {
+        auto fd = arg(1) == 7 || arg(1).in({9, 10});
+        EXPECT_TRUE(eval(fd, {7}));
+        EXPECT_TRUE(eval(fd, {9}));
+        EXPECT_TRUE(eval(fd, {10}));
+        EXPECT_FALSE(eval(fd, {8}));
+
+        auto r = fd && arg(3) != 0;
+        EXPECT_TRUE(eval(r, {9, 0, 1}));
+        EXPECT_FALSE(eval(r, {9, 0, 0}));
+        EXPECT_FALSE(eval(r, {8, 0, 1}));
+
+        // (a1 == 1 && a2 == 2) || (a1 == 3 && !(a2 in {4, 5}))
+        auto nested = any({
+            all({arg(1) == 1, arg(2) == 2}),
+            all({arg(1) == 3, arg(2) != 4, arg(2) != 5})});
+        EXPECT_TRUE(eval(nested, {1, 2}));
+        EXPECT_FALSE(eval(nested, {1, 3}));
+        EXPECT_TRUE(eval(nested, {3, 6}));
+        EXPECT_FALSE(eval(nested, {3, 4}));
+        EXPECT_FALSE(eval(nested, {2, 2}));
+
+        EXPECT_TRUE(eval(all({}), {0}));
+        EXPECT_FALSE(eval(any({}), {0}));
+
+        // chains are flattened
+        auto chain = arg(1) == 1 || arg(1) == 2 || arg(1) == 3;
+        EXPECT_EQ(chain.kind, Rule::Kind::Or);
+        EXPECT_EQ(chain.rules.size(), 3);
+        EXPECT_EQ(Program(chain).size(), 3);
+    }
+
+    TEST(Match, RejectsMalformedRules) {
+        EXPECT_THROW(arg(0), std::invalid_argument);
+        EXPECT_THROW(arg(7), std::invalid_argument);
+        EXPECT_THROW(arg(1).between(2, 1), std::invalid_argument);
+
+        std::vector<invp::A> big(Program::max_insns + 1);
+        EXPECT_THROW(Program(arg(1).in(big)), std::invalid_argument);
+
+        Rule r;
+        r.kind = Rule::Kind::Eq;
+        r.arg = 1;
+        EXPECT_THROW(Program{r}, std::invalid_argument);
+    }
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstring>
+#include <optional>
+#include <thread>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "rewrite.hh"
+
+using namespace testing;
+
+namespace sysfail {
+    namespace {
+        // mov $SYS_getpid, %eax; syscall; ret
+        const uint8_t getpid_fn[] = {
+            0xb8, SYS_getpid, 0x00, 0x00, 0x00,
+            0x0f, 0x05,
+            0xc3
+        };
+        const size_t site_offset = 5;
+
+        struct CodePage {
+            uint8_t* addr;
+
+            CodePage() {
+                void* p = mmap(
+                    nullptr,
+                    4096,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1,
+                    0);
+                assert(p != MAP_FAILED);
+                addr = static_cast<uint8_t*>(p);
+                std::memcpy(addr, getpid_fn, sizeof(getpid_fn));
+                mprotect(addr, 4096, PROT_READ | PROT_EXEC);
+            }
+
+            ~CodePage() {
+                munmap(addr, 4096);
+            }
+
+            uintptr_t site() const {
+                return reinterpret_cast<uintptr_t>(addr + site_offset);
+            }
+
+            uint16_t insn() const {
+                return *reinterpret_cast<uint16_t*>(site());
+            }
+
+            pid_t call() const {
+                return reinterpret_cast<pid_t(*)()>(addr)();
+            }
+        };
+
+        bool page0_mapped() {
+            auto m = get_mmap(getpid());
+            assert(m.has_value());
+            return m->find(0) != nullptr;
+        }
+
+        // Volatile so that reading through it is an actual load of address 0
+        const volatile uint8_t* volatile null_ptr = nullptr;
+
+        uint8_t read_null() {
+            return *null_ptr;
+        }
+
+        std::string perms(const CodePage& c) {
+            auto m = get_mmap(getpid());
+            assert(m.has_value());
+            auto r = m->find(reinterpret_cast<uintptr_t>(c.addr));
+            return r == nullptr ? "" : r->permissions;
+        }
+
+        bool has_pkeys() {
+            auto k = pkey_alloc(0, 0);
+            if (k < 0) return false;
+            pkey_free(k);
+            return true;
+        }
+    }
+
+    TEST(Rewriter, PatchesAndRestoresSyscallSites) {
+        if (!Rewriter::available()) GTEST_SKIP() << "can't map trampoline";
+
+        CodePage c;
+        ASSERT_EQ(c.call(), getpid());
+        {
+            auto m = get_mmap(getpid());
+            ASSERT_TRUE(m.has_value());
+            Rewriter r(std::move(*m));
+
+            EXPECT_TRUE(r.patch(c.site()));
+            EXPECT_EQ(c.insn(), 0xd0ff);
+            EXPECT_EQ(r.patched(), 1);
+
+            // already rewritten
+            EXPECT_FALSE(r.patch(c.site()));
+            // not a syscall instruction
+            EXPECT_FALSE(r.patch(c.site() - 1));
+
+            // goes through the trampoline, passed through without a session
+            for (int i = 0; i < 3; i++) EXPECT_EQ(c.call(), getpid());
+
+            r.demote(c.site());
+            EXPECT_EQ(c.insn(), 0x050f);
+            EXPECT_EQ(r.patched(), 0);
+            EXPECT_FALSE(r.patch(c.site()));
+            EXPECT_EQ(c.call(), getpid());
+        }
+        {
+            auto m = get_mmap(getpid());
+            ASSERT_TRUE(m.has_value());
+            Rewriter r(std::move(*m));
+            EXPECT_TRUE(r.patch(c.site()));
+        }
+        EXPECT_EQ(c.insn(), 0x050f);
+        EXPECT_EQ(c.call(), getpid());
+    }
+
+    TEST(Rewriter, IgnoresSitesOutsideKnownMappings) {
+        if (!Rewriter::available()) GTEST_SKIP() << "can't map trampoline";
+
+        auto m = get_mmap(getpid());
+        ASSERT_TRUE(m.has_value());
+        Rewriter r(std::move(*m));
+
+        // mapped after the snapshot was taken
+        CodePage c;
+        EXPECT_FALSE(r.patch(c.site()));
+        EXPECT_EQ(c.insn(), 0x050f);
+        EXPECT_EQ(r.patched(), 0);
+    }
+
+    TEST(Rewriter, RestoresOnlySitesThatStillHoldTheRewrite) {
+        if (!Rewriter::available()) GTEST_SKIP() << "can't map trampoline";
+
+        std::optional<CodePage> unloaded;
+        unloaded.emplace();
+        CodePage reprotected, recycled, kept;
+        {
+            auto m = get_mmap(getpid());
+            ASSERT_TRUE(m.has_value());
+            Rewriter r(std::move(*m));
+            for (auto* c : {&*unloaded, &reprotected, &recycled, &kept}) {
+                ASSERT_TRUE(r.patch(c->site()));
+            }
+            EXPECT_EQ(r.patched(), 4);
+
+            unloaded.reset();
+            mprotect(reprotected.addr, 4096, PROT_EXEC);
+            // other code was loaded in its place
+            mprotect(recycled.addr, 4096, PROT_READ | PROT_WRITE);
+            std::memset(recycled.addr, 0xcc, 16);
+            mprotect(recycled.addr, 4096, PROT_READ | PROT_EXEC);
+        }
+        EXPECT_EQ(kept.insn(), 0x050f);
+        EXPECT_EQ(kept.call(), getpid());
+
+        EXPECT_EQ(perms(recycled), "r-xp");
+        EXPECT_EQ(recycled.insn(), 0xcccc);
+
+        // restored, with the protection it has now
+        EXPECT_EQ(perms(reprotected), "--xp");
+        mprotect(reprotected.addr, 4096, PROT_READ | PROT_EXEC);
+        EXPECT_EQ(reprotected.insn(), 0x050f);
+    }
+
+    TEST(Rewriter, UnmapsTrampolineAfterTheLastRewriter) {
+        if (!Rewriter::available()) GTEST_SKIP() << "can't map trampoline";
+
+        CodePage c;
+        {
+            auto m = get_mmap(getpid());
+            ASSERT_TRUE(m.has_value());
+            Rewriter r1(std::move(*m));
+            EXPECT_TRUE(page0_mapped());
+            if (has_pkeys()) {
+                // execute-only
+                EXPECT_DEATH(read_null(), "");
+            }
+            {
+                auto m = get_mmap(getpid());
+                ASSERT_TRUE(m.has_value());
+                Rewriter r2(std::move(*m));
+                EXPECT_TRUE(r2.patch(c.site()));
+            }
+            // r1 still uses it
+            EXPECT_TRUE(page0_mapped());
+            EXPECT_TRUE(r1.patch(c.site()));
+            EXPECT_EQ(c.call(), getpid());
+        }
+        EXPECT_FALSE(page0_mapped());
+        EXPECT_DEATH(read_null(), "");
+        EXPECT_EQ(c.call(), getpid());
+    }
+
+    TEST(Rewriter, KeepsTrampolineWhileOtherThreadsMayBeOnIt) {
+        if (!Rewriter::available()) GTEST_SKIP() << "can't map trampoline";
+
+        CodePage c;
+        std::atomic<bool> stop = false;
+        std::thread t([&]() {
+            while (!stop) ASSERT_EQ(c.call(), getpid());
+        });
+        for (int i = 0; i < 200; i++) {
+            auto m = get_mmap(getpid());
+            ASSERT_TRUE(m.has_value());
+            Rewriter r(std::move(*m));
+            EXPECT_TRUE(r.patch(c.site()));
+            std::this_thread::yield();
+        }
+        // the thread may have been on the sled when sites were restored
+        EXPECT_TRUE(page0_mapped());
+        stop = true;
+        t.join();
+
+        {
+            auto m = get_mmap(getpid());
+            ASSERT_TRUE(m.has_value());
+            Rewriter r(std::move(*m));
+        }
+        EXPECT_FALSE(page0_mapped());
+    }
+}
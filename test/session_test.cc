@@ -18,18 +18,29 @@
 #include <sysfail.hh>
 #include <chrono>
 #include <random>
+#include <algorithm>
+#include <numeric>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <spawn.h>
+#include <sys/wait.h>
 #include <cstring>
+#include <fstream>
 #include <barrier>
+#include <latch>
+#include <semaphore>
 #include <variant>
 #include <optional>
+#include <type_traits>
 #include <oneapi/tbb/concurrent_vector.h>
 
 #include "cisq.hh"
 #include "log.hh"
 #include "signal.hh"
 #include "session.hh"
+#include "syscall.hh"
 
 using namespace testing;
 using namespace std::chrono_literals;
@@ -37,6 +48,19 @@ using namespace std::chrono_literals;
 namespace sysfail {
     using namespace Cisq;
 
+    template <typename T, typename E> void assertValue(
+        const std::variant<T, E> &e,
+        const T &v,
+        const char* file,
+        int line
+    ) {
+        ScopedTrace t(file, line, "");
+        EXPECT_FALSE(std::holds_alternative<E>(e));
+        EXPECT_EQ(std::get<0>(e), v);
+    }
+
+    #define ASSERT_VALUE(e, v) assertValue(e, v, __FILE__, __LINE__)
+
     TEST(Session, LoadSessionWithoutFailureInjection) {
         TmpFile tFile;
         tFile.write("foo bar baz quux");
@@ -154,6 +178,871 @@ namespace sysfail {
         EXPECT_LT(static_cast<double>(read_tm.count())/write_tm.count(), 1);
     }
 
+    TEST(Session, RejectsOutOfRangeSyscalls) {
+        sysfail::Plan p(
+            { {MAX_SYSCALL, {1.0, 0, 0us, {{EIO, 1.0}}}} },
+            [](pid_t pid) { return true; },
+            thread_discovery::None{});
+
+        EXPECT_THROW(sysfail::Session s(p), std::invalid_argument);
+    }
+
+    TEST(Session, IndexesPlannedOutcomesBySyscall) {
+        sysfail::ActivePlan p({
+            { {SYS_read, {1.0, 0, 0us, {{EIO, 1.0}}}},
+              {SYS_write, {0.5, 0, 0us, {{EINVAL, 1.0}}}},
+              {MAX_SYSCALL - 1, {0.25, 0, 0us, {{EFAULT, 1.0}}}} },
+            [](pid_t pid) { return true; },
+            thread_discovery::None{}});
+
+        // by_call points into the plan's own outcomes
+        static_assert(!std::is_copy_constructible_v<ActivePlan>);
+        static_assert(!std::is_move_constructible_v<ActivePlan>);
+
+        ASSERT_NE(p.outcome(SYS_read), nullptr);
+        EXPECT_EQ(p.outcome(SYS_read)->fail.p, 1.0);
+        ASSERT_NE(p.outcome(SYS_write), nullptr);
+        EXPECT_EQ(p.outcome(SYS_write)->fail.p, 0.5);
+        ASSERT_NE(p.outcome(MAX_SYSCALL - 1), nullptr);
+        EXPECT_EQ(p.outcome(MAX_SYSCALL - 1)->fail.p, 0.25);
+
+        for (Syscall c = -1; c <= MAX_SYSCALL; c++) {
+            if (c == SYS_read || c == SYS_write || c == MAX_SYSCALL - 1) {
+                continue;
+            }
+            EXPECT_EQ(p.outcome(c), nullptr) << "syscall: " << c;
+        }
+    }
+
+    TEST(Session, BuildsNormalizedErrorTables) {
+        // picks errors in proportion to weights across a uniform sweep
+        auto sweep = [](const ErrorTable& t) {
+            std::map<Errno, int> count;
+            for (int i = 0; i < 10000; i++) {
+                count[t.pick(static_cast<uint64_t>((i + 0.5) / 10000 * 0x1p64))]++;
+            }
+            return count;
+        };
+
+        auto c = sweep(ErrorTable({{EIO, 1}, {EINVAL, 3}, {EFAULT, 6}}));
+        EXPECT_EQ(c.size(), 3);
+        EXPECT_NEAR(c[EIO], 1000, 1);
+        EXPECT_NEAR(c[EINVAL], 3000, 1);
+        EXPECT_NEAR(c[EFAULT], 6000, 1);
+
+        c = sweep(ErrorTable({{EIO, 0.5}, {EACCES, 0}, {EBADF, 0.25}}));
+        EXPECT_EQ(c.size(), 2);
+        EXPECT_NEAR(c[EIO], 6667, 1);
+        EXPECT_NEAR(c[EBADF], 3333, 1);
+
+        using W = std::map<Errno, double>;
+        EXPECT_EQ(ErrorTable(W{{EIO, 42}}).pick(UINT64_MAX), EIO);
+        EXPECT_TRUE(ErrorTable(W{}).empty());
+
+        EXPECT_THROW(ErrorTable(W{{EIO, 0}}), std::invalid_argument);
+        EXPECT_THROW(ErrorTable({{EIO, -1}, {EBADF, 2}}), std::invalid_argument);
+        EXPECT_THROW(
+            ErrorTable({{EIO, std::nan("")}}),
+            std::invalid_argument);
+    }
+
+    TEST(Session, SamplesLatencyDistributions) {
+        // sorted samples, in microseconds
+        auto draw = [](
+            const latency::Distribution& d,
+            std::chrono::microseconds max
+        ) {
+            LatencySampler l(d, max);
+            Rng rng(42);
+            std::vector<double> v;
+            for (int i = 0; i < 100000; i++) {
+                v.push_back(l.sample(rng).count() / 1e3);
+            }
+            std::sort(v.begin(), v.end());
+            return v;
+        };
+        auto pct = [](const std::vector<double>& v, double p) {
+            return v[static_cast<size_t>(p * (v.size() - 1))];
+        };
+        auto mean = [](const std::vector<double>& v) {
+            return std::reduce(v.begin(), v.end()) / v.size();
+        };
+
+        auto v = draw(latency::UpToMax{}, 1000us);
+        EXPECT_NEAR(pct(v, 0.5), 500, 10);
+        EXPECT_LE(v.back(), 1000);
+        EXPECT_EQ(draw(latency::UpToMax{}, 0us).back(), 0);
+
+        v = draw(latency::Constant{2.5us}, 0us);
+        EXPECT_EQ(v.front(), 2.5);
+        EXPECT_EQ(v.back(), 2.5);
+
+        v = draw(latency::Uniform{100us, 300us}, 0us);
+        EXPECT_GE(v.front(), 100);
+        EXPECT_LE(v.back(), 300);
+        EXPECT_NEAR(pct(v, 0.25), 150, 3);
+
+        v = draw(latency::Exponential{100us}, 0us);
+        EXPECT_NEAR(mean(v), 100, 2);
+        EXPECT_NEAR(pct(v, 0.5), 100 * std::log(2), 2);
+
+        v = draw(latency::Normal{500us, 50us}, 0us);
+        EXPECT_NEAR(mean(v), 500, 1);
+        EXPECT_NEAR(pct(v, 0.8413), 550, 2);
+
+        // Mostly below 0, which counts as 0
+        v = draw(latency::Normal{-100us, 50us}, 0us);
+        EXPECT_EQ(pct(v, 0.9), 0);
+
+        v = draw(latency::LogNormal{200us, 0.5}, 0us);
+        EXPECT_NEAR(pct(v, 0.5), 200, 3);
+        EXPECT_NEAR(pct(v, 0.8413), 200 * std::exp(0.5), 6);
+
+        // P(X > x) = (scale / x)^shape
+        v = draw(latency::Pareto{10us, 2}, 0us);
+        EXPECT_GE(v.front(), 10);
+        EXPECT_NEAR(pct(v, 0.75), 20, 0.5);
+        EXPECT_NEAR(pct(v, 0.99), 100, 5);
+
+        // Capped at max_delay
+        v = draw(latency::Pareto{10us, 0.5}, 5ms);
+        EXPECT_EQ(v.back(), 5000);
+
+        // Draws of a heavy tail overflow int64_t nanoseconds (and doubles)
+        // every now and then, capped at latency::uncapped_max without a
+        // max_delay and short of overflowing with a huge one
+        using std::chrono::microseconds;
+        auto uncapped = microseconds(latency::uncapped_max).count();
+        v = draw(latency::Pareto{10us, 0.01}, 0us);
+        EXPECT_GE(v.front(), 10);
+        EXPECT_EQ(v.back(), uncapped);
+        // P(X > 1h) = (10us / 1h)^0.01 ≈ 0.82
+        EXPECT_NEAR(std::count(v.begin(), v.end(), uncapped), 82100, 500);
+        v = draw(latency::Pareto{10us, 0.01}, microseconds::max());
+        EXPECT_GE(v.front(), 10);
+        EXPECT_GT(v.back(), 1e15);
+
+        v = draw(
+            latency::Bimodal{0.1, latency::Constant{10us}, latency::Constant{1ms}},
+            0us);
+        auto slow = std::count(v.begin(), v.end(), 1000.0);
+        EXPECT_NEAR(slow, 10000, 300);
+        EXPECT_EQ(std::count(v.begin(), v.end(), 10.0), v.size() - slow);
+    }
+
+    TEST(Session, RejectsInvalidLatencyParameters) {
+        auto valid = [](const latency::Distribution& d) {
+            try {
+                LatencySampler l(d, 0us);
+                return true;
+            } catch (const std::invalid_argument&) {
+                return false;
+            }
+        };
+        EXPECT_FALSE(valid(latency::Constant{-1us}));
+        EXPECT_FALSE(valid(latency::Uniform{20us, 10us}));
+        EXPECT_FALSE(valid(latency::Uniform{-1us, 10us}));
+        EXPECT_FALSE(valid(latency::Exponential{latency::us(std::nan(""))}));
+        EXPECT_FALSE(valid(latency::Normal{10us, -1us}));
+        EXPECT_FALSE(valid(latency::LogNormal{0us, 1}));
+        EXPECT_FALSE(valid(latency::LogNormal{10us, -1}));
+        EXPECT_FALSE(valid(latency::Pareto{10us, 0}));
+        EXPECT_FALSE(valid(latency::Pareto{0us, 1}));
+        EXPECT_FALSE(valid(
+            latency::Bimodal{1.5, latency::UpToMax{}, latency::UpToMax{}}));
+        EXPECT_FALSE(valid(
+            latency::Bimodal{0.5, latency::UpToMax{}, latency::Pareto{}}));
+        EXPECT_TRUE(valid(latency::Normal{-10us, 0us}));
+        EXPECT_TRUE(valid(
+            latency::Bimodal{0, latency::Constant{1us}, latency::UpToMax{}}));
+
+        auto start = [] {
+            Session s({
+                { {SYS_read,
+                    {0, 1, 0us, {}, {}, {}, latency::Pareto{1us, -1}}} },
+                [](pid_t) { return true; },
+                thread_discovery::None{}});
+        };
+        EXPECT_THROW(start(), std::invalid_argument);
+    }
+
+    TEST(Session, NamesSyscallsInPlanErrors) {
+        try {
+            sysfail::ActivePlan p({
+                { {SYS_pwrite64, {1.0, 0, 0us, {{EIO, -1.0}}}} },
+                [](pid_t pid) { return true; },
+                thread_discovery::None{}});
+            FAIL() << "invalid weight accepted";
+        } catch (const std::invalid_argument& e) {
+            EXPECT_NE(std::string(e.what()).find("(pwrite64)"), std::string::npos)
+                << e.what();
+        }
+    }
+
+    TEST(Session, SharesCompiledPlansAcrossSessions) {
+        TmpFile f;
+        f.write("foo");
+
+        auto fails = [&] {
+            return std::holds_alternative<Cisq::Err>(f.read());
+        };
+
+        auto c = sysfail::Plan(
+            { {SYS_read, {1.0, 0, 0us, {{EIO, 1.0}}}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{}).compile();
+
+        for (int i = 0; i < 3; i++) {
+            Session s(c);
+            EXPECT_TRUE(fails());
+        }
+        EXPECT_FALSE(fails());
+
+        std::thread([&] {
+            Session s(c);
+            EXPECT_TRUE(fails());
+        }).join();
+        EXPECT_FALSE(fails());
+
+        EXPECT_THROW(
+            sysfail::Plan(
+                { {MAX_SYSCALL, {1.0, 0, 0us, {{EIO, 1.0}}}} },
+                [](pid_t tid) { return true; },
+                thread_discovery::None{}).compile(),
+            std::invalid_argument);
+        EXPECT_THROW(
+            sysfail::Plan(
+                { {SYS_read, {1.0, 0, 0us, {{EIO, 1.0}}}} },
+                [](pid_t tid) { return true; },
+                thread_discovery::OnClone{},
+                syscall_dispatch::Seccomp{}).compile(),
+            std::invalid_argument);
+    }
+
+    TEST(ThdSlots, ClaimsOneSlotPerThread) {
+        ThdSlots slots(4);
+
+        auto a = slots.claim(100);
+        ASSERT_NE(a, nullptr);
+        EXPECT_EQ(a->tid, 100);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(a) % 64, 0);
+        EXPECT_EQ(slots.claim(100), nullptr);
+        EXPECT_EQ(slots.find(100), a);
+
+        auto b = slots.claim(200);
+        ASSERT_NE(b, nullptr);
+        EXPECT_NE(a, b);
+        EXPECT_EQ(slots.tids(), (std::vector<pid_t>{100, 200}));
+
+        slots.release(a);
+        EXPECT_EQ(slots.find(100), nullptr);
+        EXPECT_EQ(slots.tids(), (std::vector<pid_t>{200}));
+
+        // freed slots are reused, capacity is respected
+        EXPECT_EQ(slots.claim(300), a);
+        EXPECT_NE(slots.claim(400), nullptr);
+        EXPECT_NE(slots.claim(500), nullptr);
+        EXPECT_EQ(slots.claim(600), nullptr);
+    }
+
+    TEST(ThdSlots, ResolvesConcurrentClaimsForTheSameThread) {
+        for (int round = 0; round < 100; round++) {
+            ThdSlots slots(16);
+            std::barrier b(4);
+            std::atomic<int> won = 0;
+            std::vector<std::thread> thds;
+            for (int i = 0; i < 4; i++) {
+                thds.emplace_back([&]() {
+                    b.arrive_and_wait();
+                    if (slots.claim(42)) won++;
+                });
+            }
+            for (auto& t : thds) t.join();
+            EXPECT_EQ(won, 1);
+            EXPECT_EQ(slots.tids(), (std::vector<pid_t>{42}));
+        }
+    }
+
+    TEST(Rng, DrawsAgainstIntegerThresholds) {
+        Rng r(42);
+        int hits = 0;
+        for (int i = 0; i < 100000; i++) {
+            EXPECT_FALSE(r.chance(threshold(0)));
+            EXPECT_TRUE(r.chance(threshold(1)));
+            if (r.chance(threshold(0.25))) hits++;
+            EXPECT_LT(r.below(10), 10);
+        }
+        EXPECT_GT(hits, 24000);
+        EXPECT_LT(hits, 26000);
+
+        // same seed, same sequence
+        Rng a(7), b(7), c(8);
+        EXPECT_EQ(a.next(), b.next());
+        EXPECT_NE(a.next(), c.next());
+    }
+
+    TEST(Session, PassesThroughUnplannedSyscalls) {
+        TmpFile f;
+        f.write("foo");
+        auto ppid = getppid();
+
+        sysfail::Plan p(
+            { {SYS_read, {1.0, 0, 0us, {{EIO, 1.0}}}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{});
+
+        Session s(p);
+        EXPECT_TRUE(std::holds_alternative<Cisq::Err>(f.read()));
+        // handled without entering the C++ handler
+        EXPECT_EQ(::syscall(SYS_getppid), ppid);
+        EXPECT_FALSE(f.write("bar").has_value());
+        // beyond MAX_SYSCALL, takes the slow path
+        errno = 0;
+        EXPECT_EQ(::syscall(MAX_SYSCALL + 1), -1);
+        EXPECT_EQ(errno, ENOSYS);
+        s.remove();
+        ASSERT_VALUE(f.read(), std::string("bar"));
+    }
+
+    TEST(Session, KeepsThreadArmedWhileSigsysIsMasked) {
+        TmpFile f;
+        f.write("foo");
+
+        sysfail::Plan p(
+            { {SYS_read, {1.0, 0, 0us, {{EIO, 1.0}}}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{});
+
+        sigset_t sigsys, cur;
+        sigemptyset(&sigsys);
+        sigaddset(&sigsys, SIGSYS);
+
+        Session s(p);
+        ASSERT_EQ(pthread_sigmask(SIG_BLOCK, &sigsys, &cur), 0);
+        EXPECT_FALSE(sigismember(&cur, SIGSYS));
+        ASSERT_EQ(pthread_sigmask(SIG_BLOCK, nullptr, &cur), 0);
+        EXPECT_TRUE(sigismember(&cur, SIGSYS));
+        // still armed
+        EXPECT_TRUE(std::holds_alternative<Cisq::Err>(f.read()));
+
+        ASSERT_EQ(pthread_sigmask(SIG_UNBLOCK, &sigsys, &cur), 0);
+        EXPECT_TRUE(sigismember(&cur, SIGSYS));
+        ASSERT_EQ(pthread_sigmask(SIG_BLOCK, nullptr, &cur), 0);
+        EXPECT_FALSE(sigismember(&cur, SIGSYS));
+        EXPECT_TRUE(std::holds_alternative<Cisq::Err>(f.read()));
+
+        // blocked for real once the thread is disabled
+        ASSERT_EQ(pthread_sigmask(SIG_BLOCK, &sigsys, nullptr), 0);
+        s.remove();
+        ASSERT_VALUE(f.read(), std::string("foo"));
+        ASSERT_EQ(pthread_sigmask(SIG_UNBLOCK, &sigsys, &cur), 0);
+        EXPECT_TRUE(sigismember(&cur, SIGSYS));
+    }
+
+    TEST(Session, TracksSigsysMaskWhilePausedOrSuspended) {
+        sysfail::Plan p(
+            { {SYS_getppid, {1.0, 0, 0us, {{EIO, 1.0}}}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{});
+
+        sigset_t sigsys, cur;
+        sigemptyset(&sigsys);
+        sigaddset(&sigsys, SIGSYS);
+        auto blocked = [&] {
+            EXPECT_EQ(pthread_sigmask(SIG_BLOCK, nullptr, &cur), 0);
+            return sigismember(&cur, SIGSYS) == 1;
+        };
+
+        Session s(p);
+
+        // Blocked while paused, in name only, resuming is safe
+        s.pause();
+        ASSERT_EQ(pthread_sigmask(SIG_BLOCK, &sigsys, nullptr), 0);
+        s.resume();
+        EXPECT_TRUE(blocked());
+        EXPECT_EQ(::syscall(SYS_getppid), -1);
+        // and blocked for real once removed
+        s.remove();
+        EXPECT_TRUE(blocked());
+        s.add();
+
+        // Unblocked while suspended, so not blocked once removed
+        s.suspend();
+        ASSERT_EQ(pthread_sigmask(SIG_UNBLOCK, &sigsys, nullptr), 0);
+        s.unsuspend();
+        EXPECT_FALSE(blocked());
+        s.remove();
+        EXPECT_FALSE(blocked());
+    }
+
+    TEST(Session, SpawnsThreadsAndProcessesWhileArmed) {
+        sysfail::Plan p(
+            { {SYS_read, {1.0, 0, 0us, {{EIO, 1.0}}}},
+              {SYS_clone, {0, 0, 0us, {}}},
+              {SYS_clone3, {0, 0, 0us, {}}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{});
+
+        auto exit_status = [](pid_t pid) {
+            int status = 0;
+            EXPECT_EQ(waitpid(pid, &status, __WALL), pid);
+            return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        };
+
+        Session s(p);
+
+        std::atomic<int> ran = 0;
+        std::thread([&] { ran++; }).join();
+        EXPECT_EQ(ran, 1);
+
+        auto pid = fork();
+        if (pid == 0) _exit(3);
+        EXPECT_EQ(exit_status(pid), 3);
+
+        pid = vfork();
+        if (pid == 0) _exit(4);
+        EXPECT_EQ(exit_status(pid), 4);
+
+        // shares the address space, on a stack of its own
+        std::vector<char> stack(64 * 1024);
+        pid = clone(
+            [](void* ran) -> int {
+                (*static_cast<std::atomic<int>*>(ran))++;
+                return 5;
+            },
+            stack.data() + stack.size(),
+            CLONE_VM | SIGCHLD,
+            &ran);
+        EXPECT_EQ(exit_status(pid), 5);
+        EXPECT_EQ(ran, 2);
+
+        char* argv[] = {(char*) "true", nullptr};
+        ASSERT_EQ(posix_spawnp(&pid, "true", nullptr, nullptr, argv, environ), 0);
+        EXPECT_EQ(exit_status(pid), 0);
+    }
+
+    TEST(Session, EnrollsThreadsAsTheyAreSpawned) {
+        TmpFile f;
+        f.write("foo");
+
+        auto fails = [&] {
+            return std::holds_alternative<Cisq::Err>(f.read());
+        };
+
+        for (syscall_dispatch::Mode m : std::vector<syscall_dispatch::Mode>{
+            syscall_dispatch::SUD{},
+            syscall_dispatch::Rewrite{}
+        }) {
+            sysfail::Plan p(
+                { {SYS_read, {1.0, 0, 0us, {{EIO, 1.0}}}} },
+                [](pid_t tid) { return true; },
+                thread_discovery::OnClone{},
+                m);
+
+            std::atomic<int> failed = 0;
+            {
+                Session s(p);
+                EXPECT_TRUE(fails());
+
+                // No discovery delay, for children and grandchildren
+                std::thread([&] {
+                    if (fails()) failed++;
+                    std::thread([&] { if (fails()) failed++; }).join();
+                }).join();
+                EXPECT_EQ(failed, 2);
+
+                // Threads spawned by threads that aren't enrolled aren't
+                s.remove();
+                std::thread([&] { if (fails()) failed++; }).join();
+                EXPECT_EQ(failed, 2);
+                s.add();
+            }
+            EXPECT_FALSE(fails());
+        }
+
+        EXPECT_THROW(
+            Session(sysfail::Plan(
+                {},
+                [](pid_t tid) { return true; },
+                thread_discovery::OnClone{},
+                syscall_dispatch::Seccomp{})),
+            std::invalid_argument);
+    }
+
+    TEST(Session, RetiresThreadsAsTheyExit) {
+        TmpFile f;
+        f.write("foo");
+
+        sysfail::Plan p(
+            { {SYS_read, {1.0, 0, 0us, {{EIO, 1.0}}}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::OnClone{});
+
+        Session s(p);
+
+        // Leaked slots would run out well before this
+        const auto thds = sysfail::ThdSlots::default_capacity + 100;
+        auto failed = 0;
+        for (size_t i = 0; i < thds; i++) {
+            std::thread([&] {
+                if (std::holds_alternative<Cisq::Err>(f.read())) failed++;
+            }).join();
+        }
+        EXPECT_EQ(failed, thds);
+    }
+
+    TEST(Session, FreesSlotsOfThreadsWhoseExitIsNotTrapped) {
+        TmpFile f;
+        f.write("foo");
+
+        sysfail::Plan p(
+            { {SYS_read, {1.0, 0, 0us, {{EIO, 1.0}}}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{});
+
+        Session s(p);
+        s.remove();
+
+        // Leaked slots would run out well before this
+        const auto thds = sysfail::ThdSlots::default_capacity + 100;
+        for (size_t i = 0; i < thds; i++) {
+            std::binary_semaphore added(0), go(0);
+            std::thread t([&] {
+                s.add();
+                added.release();
+                go.acquire();
+                // Made from sysfail's text, so never trapped (as if killed)
+                sysfail::syscall(0, 0, 0, 0, 0, 0, SYS_exit);
+            });
+            added.acquire();
+            s.discover_threads();
+            go.release();
+            t.join();
+            // Reports the thread terminated
+            s.discover_threads();
+        }
+
+        std::thread([&] {
+            s.add();
+            EXPECT_TRUE(std::holds_alternative<Cisq::Err>(f.read()));
+        }).join();
+    }
+
+    TEST(Session, RemovesThreadsThatAreExiting) {
+        sysfail::Plan p(
+            { {SYS_read, {1.0, 0, 0us, {{EIO, 1.0}}}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{});
+
+        Session s(p);
+        s.remove();
+        for (auto round = 0; round < 50; round++) {
+            const auto thds = 4;
+            std::vector<pid_t> tids(thds);
+            std::latch started(thds);
+            std::counting_semaphore<> exit(0);
+            std::vector<std::thread> threads;
+            for (auto i = 0; i < thds; i++) {
+                threads.emplace_back([&, i] {
+                    tids[i] = gettid();
+                    started.count_down();
+                    exit.acquire();
+                });
+            }
+            started.wait();
+            s.add(tids);
+            exit.release(thds);
+            s.remove(tids);
+            for (auto& t : threads) t.join();
+        }
+    }
+
+    TEST(Session, RearmsForkedChildren) {
+        TmpFile f;
+        f.write("foo");
+
+        auto fails = [&] {
+            return std::holds_alternative<Cisq::Err>(f.read());
+        };
+        auto coin_flips = [] {
+            uint64_t r = 0;
+            for (int i = 0; i < 64; i++) {
+                if (::syscall(SYS_getppid) < 0) r |= 1UL << i;
+            }
+            return r;
+        };
+
+        for (syscall_dispatch::Mode m : std::vector<syscall_dispatch::Mode>{
+            syscall_dispatch::SUD{},
+            syscall_dispatch::Rewrite{}
+        }) {
+            sysfail::Plan p(
+                {
+                    {SYS_read, {1.0, 0, 0us, {{EIO, 1.0}}}},
+                    {SYS_getppid, {0.5, 0, 0us, {{EPERM, 1.0}}}}
+                },
+                [](pid_t tid) { return true; },
+                thread_discovery::ProcPoll{1ms},
+                m);
+
+            auto s = std::make_unique<Session>(p);
+            // Threads that don't make it to the child
+            std::binary_semaphore done(0);
+            std::latch enrolled(3);
+            std::vector<std::thread> thds;
+            for (int i = 0; i < 3; i++) {
+                thds.emplace_back([&] {
+                    while (! fails()) std::this_thread::sleep_for(100us);
+                    enrolled.count_down();
+                    done.acquire();
+                    done.release();
+                });
+            }
+            enrolled.wait();
+
+            int flips[2];
+            ASSERT_EQ(pipe(flips), 0);
+            auto pid = fork();
+            if (pid == 0) {
+                uint64_t r = coin_flips();
+                if (write(flips[1], &r, sizeof(r)) != sizeof(r)) _exit(1);
+
+                if (! fails()) _exit(2);
+
+                // discovery is back
+                std::atomic<bool> found = false;
+                std::thread([&] {
+                    auto deadline = std::chrono::steady_clock::now() + 1s;
+                    while (! found && std::chrono::steady_clock::now() < deadline) {
+                        found = fails();
+                    }
+                }).join();
+                if (! found) _exit(3);
+
+                s->remove();
+                if (fails()) _exit(4);
+                s->add();
+                if (! fails()) _exit(5);
+
+                s.reset();
+                if (fails()) _exit(6);
+                _exit(0);
+            }
+            ASSERT_GT(pid, 0);
+
+            // the child's generator isn't the parent's
+            auto parent_flips = coin_flips();
+            uint64_t child_flips = 0;
+            s->remove();
+            EXPECT_EQ(read(flips[0], &child_flips, sizeof(child_flips)),
+                      sizeof(child_flips));
+            s->add();
+            EXPECT_NE(parent_flips, child_flips);
+            close(flips[0]);
+            close(flips[1]);
+
+            int status = 0;
+            ASSERT_EQ(waitpid(pid, &status, 0), pid);
+            EXPECT_TRUE(WIFEXITED(status));
+            EXPECT_EQ(WEXITSTATUS(status), 0);
+
+            EXPECT_TRUE(fails());
+            done.release();
+            for (auto& t : thds) t.join();
+            s.reset();
+            EXPECT_FALSE(fails());
+        }
+    }
+
+    TEST(Session, EnrollsThreadsInBatches) {
+        TmpFile f;
+        f.write("foo");
+
+        sysfail::Plan p(
+            { {SYS_read, {1.0, 0, 0us, {{EIO, 1.0}}}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{});
+
+        const auto thds = 8;
+        std::vector<pid_t> tids(thds);
+        std::barrier started(thds + 1), enrolled(thds + 1), removed(thds + 1);
+        std::atomic<int> failed = 0, succeeded = 0;
+        std::vector<std::thread> threads;
+        {
+            Session s(p);
+            s.remove();
+            for (auto i = 0; i < thds; i++) {
+                threads.emplace_back([&, i] {
+                    tids[i] = gettid();
+                    started.arrive_and_wait();
+                    enrolled.arrive_and_wait();
+                    if (std::holds_alternative<Cisq::Err>(f.read())) failed++;
+                    removed.arrive_and_wait();
+                    removed.arrive_and_wait();
+                    if (!std::holds_alternative<Cisq::Err>(f.read())) succeeded++;
+                });
+            }
+            started.arrive_and_wait();
+            s.add(tids);
+            enrolled.arrive_and_wait();
+            removed.arrive_and_wait();
+            s.remove(tids);
+            removed.arrive_and_wait();
+            for (auto& t : threads) t.join();
+        }
+        EXPECT_EQ(failed, thds);
+        EXPECT_EQ(succeeded, thds);
+    }
+
+    TEST(Session, PausesAndSuspendsEnrolledThreads) {
+        TmpFile f;
+        f.write("foo");
+
+        auto fails = [&] {
+            return std::holds_alternative<Cisq::Err>(f.read());
+        };
+
+        for (syscall_dispatch::Mode m : std::vector<syscall_dispatch::Mode>{
+            syscall_dispatch::SUD{},
+            syscall_dispatch::Seccomp{},
+            syscall_dispatch::Rewrite{}
+        }) {
+            sysfail::Plan p(
+                { {SYS_read, {1.0, 0, 0us, {{EIO, 1.0}}}} },
+                [](pid_t tid) { return true; },
+                thread_discovery::None{},
+                m);
+
+            Session s(p);
+            EXPECT_TRUE(fails());
+
+            s.pause();
+            EXPECT_FALSE(fails());
+            s.resume();
+            EXPECT_TRUE(fails());
+
+            s.suspend(gettid());
+            EXPECT_FALSE(fails());
+            s.pause();
+            s.resume();
+            EXPECT_FALSE(fails());
+            s.unsuspend(gettid());
+            EXPECT_TRUE(fails());
+
+            // Threads added while paused stay paused
+            s.pause();
+            std::thread([&] {
+                s.add();
+                EXPECT_FALSE(fails());
+                s.resume();
+                EXPECT_TRUE(fails());
+                s.remove();
+                EXPECT_FALSE(fails());
+            }).join();
+            EXPECT_TRUE(fails());
+
+            // Suspension does not outlive enrollment
+            s.suspend(gettid());
+            s.remove();
+            s.add();
+            EXPECT_TRUE(fails());
+            s.remove();
+        }
+        EXPECT_FALSE(fails());
+    }
+
+    TEST(Session, ResumesThreadsWhileTheyBlockSignals) {
+        Session s({
+            { {SYS_getppid, {1.0, 0, 0us, {{EIO, 1.0}}}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{}});
+
+        // libc blocks all signals around clone, resumes land in that window
+        std::atomic<bool> done = false;
+        std::thread toggler([&] {
+            while (! done.load()) {
+                s.pause();
+                s.resume();
+            }
+        });
+        s.pause();
+        for (int i = 0; i < 500; i++) {
+            std::thread([] {}).join();
+        }
+        done.store(true);
+        toggler.join();
+        s.resume();
+
+        EXPECT_EQ(::syscall(SYS_getppid), -1);
+        EXPECT_EQ(errno, EIO);
+
+        sigset_t set;
+        ASSERT_EQ(pthread_sigmask(SIG_SETMASK, nullptr, &set), 0);
+        EXPECT_FALSE(sigismember(&set, SIGSYS));
+    }
+
+    TEST(Session, ScopesConfineInjectionOfSuspendedThreads) {
+        TmpFile f;
+        f.write("foo");
+
+        auto fails = [&] {
+            return std::holds_alternative<Cisq::Err>(f.read());
+        };
+
+        for (syscall_dispatch::Mode m : std::vector<syscall_dispatch::Mode>{
+            syscall_dispatch::SUD{},
+            syscall_dispatch::Seccomp{},
+            syscall_dispatch::Rewrite{}
+        }) {
+            sysfail::Plan p(
+                { {SYS_read, {1.0, 0, 0us, {{EIO, 1.0}}}} },
+                [](pid_t tid) { return true; },
+                thread_discovery::None{},
+                m);
+
+            Session s(p);
+            {
+                Scope sc;
+                EXPECT_TRUE(fails());
+            }
+            EXPECT_TRUE(fails());
+
+            s.suspend();
+            EXPECT_FALSE(fails());
+            {
+                Scope outer;
+                EXPECT_TRUE(fails());
+                {
+                    Scope inner;
+                    EXPECT_TRUE(fails());
+                }
+                EXPECT_TRUE(fails());
+
+                s.pause();
+                EXPECT_FALSE(fails());
+                s.resume();
+                EXPECT_TRUE(fails());
+            }
+            EXPECT_FALSE(fails());
+
+            // Outlives the thread's enrollment
+            {
+                Scope sc;
+                s.remove();
+                EXPECT_FALSE(fails());
+                s.add();
+                s.suspend();
+            }
+            EXPECT_FALSE(fails());
+            {
+                Scope sc;
+                EXPECT_TRUE(fails());
+            }
+            s.remove();
+        }
+        EXPECT_FALSE(fails());
+    }
+
     struct Result {
         pid_t thd_id;
         int success;
@@ -395,6 +1284,192 @@ namespace sysfail {
         EXPECT_EQ(1000, eio_count + einval_count + efault_count);
     }
 
+    TEST(Session, ErrorDistributionOfWideErrorMix) {
+        TmpFile f;
+        f.write("foo");
+
+        // weights are normalized, they don't need to add up to 1
+        std::map<Errno, double> weights{
+            {EIO, 1}, {EINTR, 1}, {EAGAIN, 1}, {ENOMEM, 1}, {EBADF, 1},
+            {EFAULT, 1}, {EINVAL, 1}, {ECONNRESET, 1}, {ETIMEDOUT, 1},
+            {EPIPE, 11}};
+
+        sysfail::Plan p(
+            { { SYS_read, {1.0, 0, 0us, weights}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{});
+
+        std::unordered_map<Errno, int> error_count;
+
+        {
+            Session s(p);
+            for (int i = 0; i < 2000; i++) {
+                auto ret = f.read();
+                ASSERT_TRUE(std::holds_alternative<Cisq::Err>(ret));
+                error_count[std::get<1>(ret).err()]++;
+            }
+        }
+
+        EXPECT_EQ(10, error_count.size());
+        // EPIPE is drawn with p = 0.55, the rest with p = 0.05 each
+        EXPECT_GT(error_count[EPIPE], 1000);
+        EXPECT_LT(error_count[EPIPE], 1200);
+        for (const auto& [e, w] : weights) {
+            if (e == EPIPE) continue;
+            EXPECT_GT(error_count[e], 50) << "errno: " << e;
+            EXPECT_LT(error_count[e], 150) << "errno: " << e;
+        }
+    }
+
+    TEST(Session, InjectsFailuresOnlyWhenArgumentsMatch) {
+        auto fd = open("/dev/zero", O_RDONLY);
+        ASSERT_GE(fd, 0);
+        char buf[64];
+
+        sysfail::Plan p(
+            { {SYS_read, {1.0, 0, 0us, {{EIO, 1.0}}, nullptr,
+                match::arg(1) == fd && match::arg(3).between(1, 16)}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{});
+
+        {
+            Session s(p);
+            for (int i = 0; i < 10; i++) {
+                errno = 0;
+                EXPECT_EQ(::syscall(SYS_read, fd, buf, 16), -1);
+                EXPECT_EQ(errno, EIO);
+                EXPECT_EQ(::syscall(SYS_read, fd, buf, 32), 32);
+            }
+        }
+        close(fd);
+    }
+
+    TEST(Session, SeccompDispatchTrapsOnlyPlannedSyscalls) {
+        TmpFile f;
+        f.write("foo");
+
+        sysfail::Plan p(
+            { {SYS_read, {1.0, 0, 0us, {{EIO, 1.0}}}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{},
+            syscall_dispatch::Seccomp{});
+
+        // seccomp filters outlive the session, keep it off the test thread
+        std::thread t([&]() {
+            {
+                Session s(p);
+                s.add();
+                for (int i = 0; i < 10; i++) {
+                    auto r = f.read();
+                    ASSERT_TRUE(std::holds_alternative<Cisq::Err>(r));
+                    EXPECT_EQ(std::get<1>(r).err(), EIO);
+                    EXPECT_FALSE(f.write("bar").has_value());
+                }
+
+                s.remove();
+                ASSERT_VALUE(f.read(), std::string("bar"));
+
+                s.add();
+                EXPECT_TRUE(std::holds_alternative<Cisq::Err>(f.read()));
+            }
+            // filter still traps SYS_read, but it is passed through
+            ASSERT_VALUE(f.read(), std::string("bar"));
+        });
+        t.join();
+    }
+
+    namespace {
+        // Seccomp filters installed on the calling thread, -1 if unknown
+        int seccomp_filters() {
+            std::ifstream status("/proc/thread-self/status");
+            std::string line;
+            while (std::getline(status, line)) {
+                if (line.starts_with("Seccomp_filters:")) {
+                    return std::stoi(line.substr(line.find(':') + 1));
+                }
+            }
+            return -1;
+        }
+    }
+
+    TEST(Session, SeccompDispatchReusesFiltersThatCoverThePlan) {
+        auto plan = [](std::vector<Syscall> calls) {
+            std::unordered_map<Syscall, const Outcome> o;
+            for (auto c : calls) o.emplace(c, Outcome{0, 0, 0us, {{EIO, 1}}});
+            return sysfail::Plan(
+                o,
+                [](pid_t tid) { return true; },
+                thread_discovery::None{},
+                syscall_dispatch::Seccomp{});
+        };
+
+        std::thread t([&]() {
+            auto initial = seccomp_filters();
+            if (initial < 0) GTEST_SKIP() << "Seccomp_filters not reported";
+
+            auto p = plan({SYS_read, SYS_write});
+            for (int i = 0; i < 100; i++) {
+                Session s(p);
+                s.add();
+            }
+            EXPECT_EQ(seccomp_filters(), initial + 1);
+
+            // a subset of the trapped syscalls needs no new filter
+            for (int i = 0; i < 100; i++) {
+                Session s(plan({SYS_write}));
+                s.add();
+            }
+            EXPECT_EQ(seccomp_filters(), initial + 1);
+
+            // but one planning another syscall does
+            {
+                Session s(plan({SYS_read, SYS_getppid}));
+                s.add();
+            }
+            EXPECT_EQ(seccomp_filters(), initial + 2);
+            {
+                Session s(plan({SYS_getppid, SYS_write}));
+                s.add();
+            }
+            EXPECT_EQ(seccomp_filters(), initial + 2);
+        });
+        t.join();
+    }
+
+    TEST(Session, RewriteDispatchInjectsFailuresFromRewrittenSites) {
+        TmpFile f;
+        f.write("foo");
+
+        sysfail::Plan p(
+            { {SYS_read, {1.0, 0, 0us, {{EIO, 1.0}}}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{},
+            syscall_dispatch::Rewrite{});
+
+        {
+            Session s(p);
+            // first read traps and rewrites the site, later ones don't trap
+            for (int i = 0; i < 10; i++) {
+                auto r = f.read();
+                ASSERT_TRUE(std::holds_alternative<Cisq::Err>(r));
+                EXPECT_EQ(std::get<1>(r).err(), EIO);
+            }
+
+            // rewritten sites are shared, but only enrolled threads fail
+            std::thread t([&]() {
+                ASSERT_VALUE(f.read(), std::string("foo"));
+            });
+            t.join();
+
+            s.remove();
+            ASSERT_VALUE(f.read(), std::string("foo"));
+
+            s.add();
+            EXPECT_TRUE(std::holds_alternative<Cisq::Err>(f.read()));
+        }
+        ASSERT_VALUE(f.read(), std::string("foo"));
+    }
+
     TEST(Session, StopFailureInjectionOnOtherThreads) {
         TmpFile f;
         f.write("foo");
@@ -790,18 +1865,82 @@ namespace sysfail {
         EXPECT_GT(d.with.wr / d.without.wr, 150) << fail_msg;
     }
 
-    template <typename T, typename E> void assertValue(
-        const std::variant<T, E> &e,
-        const T &v,
-        const char* file,
-        int line
-    ) {
-        ScopedTrace t(file, line, "");
-        EXPECT_FALSE(std::holds_alternative<E>(e));
-        EXPECT_EQ(std::get<0>(e), v);
+    TEST(Session, DelaysWithoutLibcSleeps) {
+        // Sleeps failing would cut libc-based delays short
+        Session s({
+            { {SYS_getppid, {0, 1, 2ms, {}}},
+              {SYS_nanosleep, {1, 0, 0us, {{EINVAL, 1}}}},
+              {SYS_clock_nanosleep, {1, 0, 0us, {{EINVAL, 1}}}} },
+            [](pid_t) { return true; },
+            thread_discovery::None{}});
+
+        timespec ts{0, 1000};
+        EXPECT_EQ(clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, nullptr), EINVAL);
+
+        // 50ms expected
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 50; i++) ::syscall(SYS_getppid);
+        EXPECT_GT(std::chrono::steady_clock::now() - start, 25ms);
     }
 
-    #define ASSERT_VALUE(e, v) assertValue(e, v, __FILE__, __LINE__)
+    TEST(Session, DelaysFollowTheLatencyDistribution) {
+        Session s({
+            { {SYS_getppid, {0, 1, 0us, {}, {}, {},
+                latency::Bimodal{
+                    0.5, latency::Constant{50us}, latency::Constant{2ms}}}} },
+            [](pid_t) { return true; },
+            thread_discovery::None{}});
+
+        std::vector<std::chrono::nanoseconds> took;
+        for (int i = 0; i < 200; i++) {
+            auto start = std::chrono::steady_clock::now();
+            ::syscall(SYS_getppid);
+            took.push_back(std::chrono::steady_clock::now() - start);
+        }
+
+        auto slow = std::count_if(
+            took.begin(), took.end(), [](auto t) { return t >= 2ms; });
+        EXPECT_NEAR(slow, 100, 30);
+        EXPECT_GE(*std::min_element(took.begin(), took.end()), 50us);
+    }
+
+    TEST(Session, DelaysWithoutSpinningByDefault) {
+        Session s({
+            { {SYS_getppid,
+                {0, 1, 0us, {}, {}, {}, latency::Constant{500us}}} },
+            [](pid_t) { return true; },
+            thread_discovery::None{}});
+
+        auto cpu = [] {
+            timespec ts;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+            return std::chrono::seconds(ts.tv_sec) +
+                std::chrono::nanoseconds(ts.tv_nsec);
+        };
+        auto start = cpu();
+        for (int i = 0; i < 50; i++) ::syscall(SYS_getppid);
+        // 25ms of delays, a 100us spin each would burn 5ms
+        EXPECT_LT(cpu() - start, 2ms);
+    }
+
+    TEST(Session, SetsTimerSlackOfEnrolledThreads) {
+        auto before = prctl(PR_GET_TIMERSLACK);
+        ASSERT_NE(before, 1000);
+        {
+            Session s({
+                {},
+                [](pid_t) { return true; },
+                thread_discovery::None{},
+                syscall_dispatch::SUD{},
+                Delays{20us, 1us}});
+            EXPECT_EQ(prctl(PR_GET_TIMERSLACK), 1000);
+            s.remove();
+            EXPECT_EQ(prctl(PR_GET_TIMERSLACK), before);
+            s.add();
+            EXPECT_EQ(prctl(PR_GET_TIMERSLACK), 1000);
+        }
+        EXPECT_EQ(prctl(PR_GET_TIMERSLACK), before);
+    }
 
     TEST(Session, DoesNotFailIneligibleSyscalls) {
         Pipe<int> p1, p2;
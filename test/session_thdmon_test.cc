@@ -26,6 +26,7 @@
 #include <regex>
 #include <barrier>
 #include <thread>
+#include <condition_variable>
 #include <cmath>
 #include <filesystem>
 #include <oneapi/tbb/concurrent_vector.h>
@@ -323,4 +324,49 @@ namespace sysfail {
         test_manual_polling_based_thread_discovery(
             thread_discovery::ProcPoll{10min});
     }
+
+    TEST(SessionThdMon, ReportsDiscoveryStats) {
+        sysfail::Plan p(
+            { {SYS_read, {1.0, 0, 0us, {{EIO, 1}}}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::None{});
+
+        Session s(p);
+        auto st = s.discovery_stats();
+        EXPECT_EQ(st.polls, 1);
+        EXPECT_EQ(st.spawned, 0);
+        EXPECT_EQ(st.itvl, 0us);
+
+        s.discover_threads();
+        st = s.discovery_stats();
+        EXPECT_EQ(st.polls, 2);
+        EXPECT_GT(st.poll_cpu, 0ns);
+    }
+
+    TEST(SessionThdMon, InjectsFailuresIntoThreadsAsTheKernelReportsThem) {
+        TmpFile f;
+        f.write("foo");
+
+        sysfail::Plan p(
+            { {SYS_read, {1.0, 0, 0us, {{EIO, 1}}}} },
+            [](pid_t tid) { return true; },
+            thread_discovery::ProcConnector(thread_discovery::ProcPoll{30min}));
+
+        Session s(p);
+        if (s.discovery_stats().itvl != 0us) {
+            GTEST_SKIP() << "Proc connector unavailable";
+        }
+
+        std::thread([&]() {
+            auto deadline = std::chrono::steady_clock::now() + 1s;
+            bool failed = false;
+            while (! failed && std::chrono::steady_clock::now() < deadline) {
+                failed = std::holds_alternative<Cisq::Err>(f.read());
+                if (! failed) std::this_thread::sleep_for(100us);
+            }
+            EXPECT_TRUE(failed);
+        }).join();
+
+        EXPECT_EQ(s.discovery_stats().spawned, 1);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,171 @@
+/*
+ * Copyright © 2024 Rubrik, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <sysfail.hh>
+#include <sysfail_static.hh>
+#include <cstring>
+#include <map>
+#include <fcntl.h>
+
+#include "cisq.hh"
+#include "session.hh"
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace sysfail {
+    using namespace static_plan;
+
+    namespace {
+        struct Tally {
+            int delayed = 0, delayed_after = 0;
+            int failed = 0, failed_after = 0;
+            std::map<Errno, int> errs;
+            std::chrono::nanoseconds max_delay{0};
+        };
+
+        template <typename D> Tally tally(D decide, Syscall call, int n) {
+            gregset_t regs;
+            std::memset(regs, 0, sizeof(regs));
+            regs[REG_RAX] = call;
+            Rng rng(42);
+            Tally t;
+            for (int i = 0; i < n; i++) {
+                Injection inj;
+                decide(regs, rng, inj);
+                t.delayed += inj.delay.count() != 0;
+                t.delayed_after += inj.delay_after.count() != 0;
+                t.max_delay = std::max({t.max_delay, inj.delay, inj.delay_after});
+                t.failed += inj.fail != 0;
+                t.failed_after += inj.fail_after != 0;
+                if (inj.fail || inj.fail_after) {
+                    t.errs[inj.fail ? inj.fail : inj.fail_after]++;
+                }
+            }
+            return t;
+        }
+    }
+
+    TEST(StaticPlan, DecidesLikeTheEquivalentPlan) {
+        using P = StaticPlan<
+            Rule<SYS_write,
+                Fail<0.3, 0.25>,
+                Delay<0.2, 1000, 0.5>,
+                Error<EIO, 1>,
+                Error<ENOSPC, 3>,
+                Error<EINTR, 0>>,
+            Rule<SYS_fsync, Fail<1>, Error<EIO>>>;
+
+        ActivePlan dyn({
+            { {SYS_write, {
+                {0.3, 0.25},
+                {0.2, 0.5},
+                1000us,
+                {{EIO, 1}, {ENOSPC, 3}, {EINTR, 0}}}},
+              {SYS_fsync, {1, 0, 0us, {{EIO, 1}}}} },
+            [](pid_t) { return true; },
+            thread_discovery::None{}});
+
+        const int n = 100000;
+        auto s = tally(P::decide, SYS_write, n);
+        auto d = tally(
+            [&](auto regs, auto& rng, auto& inj) { dyn.decide(regs, rng, inj); },
+            SYS_write,
+            n);
+
+        for (auto t : {s, d}) {
+            EXPECT_NEAR(t.failed + t.failed_after, 0.3 * n, 0.01 * n);
+            EXPECT_NEAR(t.failed_after, 0.25 * 0.3 * n, 0.01 * n);
+            EXPECT_NEAR(t.delayed + t.delayed_after, 0.2 * n, 0.01 * n);
+            EXPECT_NEAR(t.delayed_after, 0.5 * 0.2 * n, 0.01 * n);
+            EXPECT_LE(t.max_delay, 1000us);
+            EXPECT_GT(t.max_delay, 900us);
+            EXPECT_EQ(t.errs.count(EINTR), 0);
+            EXPECT_NEAR(t.errs[ENOSPC], 3 * t.errs[EIO], 0.15 * t.errs[ENOSPC]);
+        }
+
+        s = tally(P::decide, SYS_fsync, 100);
+        EXPECT_EQ(s.failed, 100);
+        EXPECT_EQ(s.errs[EIO], 100);
+
+        s = tally(P::decide, SYS_read, 100);
+        EXPECT_EQ(s.failed + s.failed_after + s.delayed + s.delayed_after, 0);
+    }
+
+    TEST(StaticPlan, InlinesPredicates) {
+        using P = StaticPlan<
+            Rule<SYS_write,
+                Fail<1>,
+                Error<EIO>,
+                Where<[](const greg_t* r) { return r[REG_RDI] == 3; }>,
+                Where<[](const greg_t* r) { return 10 < r[REG_RDX]; }>>>;
+
+        gregset_t regs;
+        std::memset(regs, 0, sizeof(regs));
+        regs[REG_RAX] = SYS_write;
+        Rng rng(42);
+
+        auto fails = [&](greg_t fd, greg_t len) {
+            regs[REG_RDI] = fd;
+            regs[REG_RDX] = len;
+            Injection inj;
+            P::decide(regs, rng, inj);
+            return inj.fail == EIO;
+        };
+
+        EXPECT_TRUE(fails(3, 11));
+        EXPECT_FALSE(fails(4, 11));
+        EXPECT_FALSE(fails(3, 10));
+    }
+
+    TEST(StaticPlan, InjectsFailuresIntoSessions) {
+        Cisq::TmpFile f;
+        f.write("foo");
+
+        using P = StaticPlan<Rule<SYS_read, Fail<1>, Error<EIO>>>;
+        auto c = P::compile(
+            [](pid_t) { return true; },
+            thread_discovery::None{});
+
+        for (syscall_dispatch::Mode m : std::vector<syscall_dispatch::Mode>{
+            syscall_dispatch::SUD{},
+            syscall_dispatch::Rewrite{}
+        }) {
+            Session s(P::compile(
+                [](pid_t) { return true; },
+                thread_discovery::None{},
+                m));
+            auto r = f.read();
+            ASSERT_TRUE(std::holds_alternative<Cisq::Err>(r));
+            EXPECT_EQ(std::get<Cisq::Err>(r).err(), EIO);
+            EXPECT_FALSE(f.write("bar"));
+        }
+
+        {
+            Session s(c);
+            EXPECT_TRUE(std::holds_alternative<Cisq::Err>(f.read()));
+        }
+        EXPECT_FALSE(std::holds_alternative<Cisq::Err>(f.read()));
+
+        EXPECT_THROW(
+            P::compile(
+                [](pid_t) { return true; },
+                thread_discovery::OnClone{},
+                syscall_dispatch::Seccomp{}),
+            std::invalid_argument);
+    }
+}
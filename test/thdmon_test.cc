@@ -18,6 +18,8 @@
 #include <variant>
 #include <optional>
 #include <chrono>
+#include <sched.h>
+#include <sys/wait.h>
 
 #include <oneapi/tbb/concurrent_vector.h>
 
@@ -128,8 +130,10 @@ namespace sysfail {
         });
 
         {
-            ThdMon tmon(P{10ms}, [&](pid_t tid, DiscThdSt state) {
-                live_evts.push_back(TMonEvt{tid, state});
+            ThdMon tmon(P{10ms}, [&](std::span<const pid_t> tids, DiscThdSt state) {
+                for (auto tid : tids) {
+                    live_evts.push_back(TMonEvt{tid, state});
+                }
             });
 
             with_delay([&live_evts]() { live_evts.push_back(TestEvt::Start); });
@@ -315,8 +319,10 @@ namespace sysfail {
 
         pid_t child_pid = 0;
         {
-            ThdMon tmon(P{10ms}, [&](pid_t tid, DiscThdSt state) {
-                live_evts.push_back(TMonEvt{tid, state});
+            ThdMon tmon(P{10ms}, [&](std::span<const pid_t> tids, DiscThdSt state) {
+                for (auto tid : tids) {
+                    live_evts.push_back(TMonEvt{tid, state});
+                }
             });
 
             child_pid = fork();
@@ -348,11 +354,116 @@ namespace sysfail {
 
         auto start_tm = std::chrono::system_clock::now();
         {
-            ThdMon tmon(P{30min}, [&](pid_t tid, DiscThdSt state) {
-                live_evts.push_back(TMonEvt{tid, state});
+            ThdMon tmon(P{30min}, [&](std::span<const pid_t> tids, DiscThdSt state) {
+                for (auto tid : tids) {
+                    live_evts.push_back(TMonEvt{tid, state});
+                }
             });
             std::this_thread::sleep_for(5ms);
         }
         EXPECT_LT((std::chrono::system_clock::now() - start_tm), 20ms);
     }
+
+    TEST(ThdMon, AdaptsPollIntervalToThreadActivity) {
+        EXPECT_THROW(P(0us, 1ms), std::invalid_argument);
+        EXPECT_THROW(P(2ms, 1ms), std::invalid_argument);
+
+        auto wait_for_itvl = [](ThdMon& tmon, auto pred) {
+            auto deadline = std::chrono::steady_clock::now() + 5s;
+            while (std::chrono::steady_clock::now() < deadline) {
+                if (pred(tmon.stats().itvl)) return true;
+                std::this_thread::sleep_for(100us);
+            }
+            return false;
+        };
+
+        std::atomic<int> spawned = 0;
+        ThdMon tmon(P{1ms, 16ms}, [&](std::span<const pid_t> tids, DiscThdSt state) {
+            if (state == DiscThdSt::Spawned) spawned += tids.size();
+        });
+
+        // backs off while nothing changes
+        EXPECT_TRUE(wait_for_itvl(tmon, [](auto i) { return i == 16ms; }));
+        auto polls = tmon.stats().polls;
+
+        std::binary_semaphore done(0);
+        std::thread t([&]() { done.acquire(); });
+
+        // and goes back to polling often once a thread shows up
+        EXPECT_TRUE(wait_for_itvl(tmon, [](auto i) { return i < 16ms; }));
+        EXPECT_EQ(spawned, 1);
+
+        auto st = tmon.stats();
+        EXPECT_GT(st.polls, polls);
+        EXPECT_GT(st.poll_cpu, 0ns);
+        EXPECT_EQ(st.spawned, 1);
+        EXPECT_GT(st.max_latency, 0us);
+        EXPECT_EQ(st.mean_latency, st.max_latency);
+
+        done.release();
+        t.join();
+    }
+
+    TEST(ThdMon, ReportsThreadActivityFromProcEvents) {
+        oneapi::tbb::concurrent_vector<TMonEvt> live_evts;
+        auto hdlr = [&](std::span<const pid_t> tids, DiscThdSt state) {
+            for (auto tid : tids) live_evts.push_back(TMonEvt{tid, state});
+        };
+        auto reported = [&](pid_t tid, DiscThdSt state) {
+            auto deadline = std::chrono::steady_clock::now() + 1s;
+            while (std::chrono::steady_clock::now() < deadline) {
+                for (auto& e : live_evts) {
+                    if (e.tid == tid && e.state == state) return true;
+                }
+                std::this_thread::sleep_for(100us);
+            }
+            return false;
+        };
+
+        // a poll would find nothing for half an hour
+        ThdMon tmon(thread_discovery::ProcConnector(P{30min}), hdlr);
+        if (tmon.stats().itvl != 0us) {
+            GTEST_SKIP() << "Proc connector unavailable";
+        }
+        EXPECT_EQ(tmon.stats().polls, 1);
+
+        std::binary_semaphore done(0);
+        std::atomic<pid_t> tid = 0;
+        std::thread t([&]() {
+            tid = gettid();
+            done.acquire();
+        });
+        while (tid == 0) std::this_thread::yield();
+
+        EXPECT_TRUE(reported(tid, DiscThdSt::Spawned));
+        done.release();
+        t.join();
+        EXPECT_TRUE(reported(tid, DiscThdSt::Terminated));
+
+        auto st = tmon.stats();
+        EXPECT_EQ(st.polls, 1);
+        EXPECT_EQ(st.spawned, 1);
+        EXPECT_LT(st.max_latency, 1s);
+    }
+
+    TEST(ThdMon, FallsBackToPollingWithoutProcConnector) {
+        // the kernel ignores subscriptions from outside the initial user
+        // namespace
+        auto pid = fork();
+        ASSERT_GE(pid, 0);
+        if (pid == 0) {
+            if (unshare(CLONE_NEWUSER) != 0) _exit(2);
+            ThdMon tmon(
+                thread_discovery::ProcConnector(P{1ms}),
+                [](std::span<const pid_t>, DiscThdSt) {});
+            _exit(tmon.stats().itvl == 1ms ? 0 : 1);
+        }
+        int status;
+        ASSERT_EQ(waitpid(pid, &status, 0), pid);
+        ASSERT_TRUE(WIFEXITED(status));
+        if (WEXITSTATUS(status) == 2) {
+            GTEST_SKIP() << "Couldn't unshare user namespace";
+        }
+        EXPECT_EQ(WEXITSTATUS(status), 0);
+    }
 }
\ No newline at end of file